@@ -4,23 +4,30 @@
 OUTPUT="dist/rnn"
 
 # Define your source files
-SOURCES="src/main.c src/matrix/matrix.c src/vocabulary/vocabulary.c src/model/rnn.c"
+SOURCES="src/main.c src/matrix/matrix.c src/matrix/sparse.c src/matrix/autotune.c src/matrix/expr.c src/vocabulary/vocabulary.c src/model/rnn.c src/model/evaluate.c src/model/ngram.c src/model/speculative.c src/server/server.c src/data/dataset.c src/tokenizer/bpe.c src/parallel/comm.c src/parallel/data_parallel.c"
 
 # Define any compiler flags if needed (e.g., for debugging)
-CFLAGS="-Wall -g"
+# -march=native enables the SIMD kernels (AVX2/FMA) when the host supports them;
+# -ffp-contract=off keeps tuned kernels bit-identical to the plain loops
+CFLAGS="-Wall -g -O2 -march=native -ffp-contract=off"
+
+# Attribute every matrix to its allocating line and report leaks: MATRIX_TRACK=1 ./build.sh
+if [ -n "$MATRIX_TRACK" ]; then
+    CFLAGS="$CFLAGS -DMATRIX_TRACK_ALLOCATIONS"
+fi
 
 # Make sure the dist directory exists
 mkdir -p dist
 
 # Compile the source files into an executable
-gcc $CFLAGS $SOURCES -o $OUTPUT -lm
+gcc $CFLAGS $SOURCES -o $OUTPUT -lm -lpthread
 
 # Check if the compilation was successful
 if [ $? -eq 0 ]; then
     echo "Compilation successful!"
 
-    # Run the program 
-    ./$OUTPUT
+    # Run the program; its kernel tuning results stay in dist/ rather than ~/.cache
+    RNN_TUNING_CACHE="${RNN_TUNING_CACHE:-dist/rnn-kernels.txt}" ./$OUTPUT
 else
     echo "Compilation failed."
 fi
@@ -0,0 +1,417 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dataset.h"
+
+// Split text into whitespace separated words, one sentence per line.
+// Unseen words are added to the vocabulary and every line ends with <eos>.
+uint32_t *dataset_tokenize(Vocabulary *v, const char *text, size_t *num_tokens)
+{
+    size_t capacity = 1024;
+    size_t count = 0;
+    uint32_t *tokens = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+    if (!tokens)
+    {
+        fprintf(stderr, "Error: Unable to allocate memory for tokens\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char word[256];
+    const char *p = text;
+    int line_has_words = 0;
+
+    while (*p)
+    {
+        int id = -1;
+        if (*p == '\n')
+        {
+            p++;
+            if (!line_has_words)
+                continue;
+            id = VOCAB_EOS;
+            line_has_words = 0;
+        }
+        else if (isspace((unsigned char)*p))
+        {
+            p++;
+            continue;
+        }
+        else
+        {
+            size_t len = 0;
+            while (*p && !isspace((unsigned char)*p))
+            {
+                if (len < sizeof(word) - 1)
+                    word[len++] = *p;
+                p++;
+            }
+            word[len] = '\0';
+
+            id = vocabulary_get_index(v, word);
+            if (id == -1)
+                id = v->size < v->capacity ? vocabulary_add_word(v, word) : VOCAB_UNK;
+            line_has_words = 1;
+        }
+
+        if (count == capacity)
+        {
+            capacity *= 2;
+            uint32_t *grown = (uint32_t *)realloc(tokens, capacity * sizeof(uint32_t));
+            if (!grown)
+            {
+                fprintf(stderr, "Error: Unable to allocate memory for tokens\n");
+                exit(EXIT_FAILURE);
+            }
+            tokens = grown;
+        }
+        tokens[count++] = (uint32_t)id;
+    }
+
+    // Terminate a final line that has no trailing newline
+    if (line_has_words)
+    {
+        uint32_t *grown = (uint32_t *)realloc(tokens, (count + 1) * sizeof(uint32_t));
+        if (!grown)
+        {
+            fprintf(stderr, "Error: Unable to allocate memory for tokens\n");
+            exit(EXIT_FAILURE);
+        }
+        tokens = grown;
+        tokens[count++] = VOCAB_EOS;
+    }
+
+    *num_tokens = count;
+    return tokens;
+}
+
+// Write tokens using the narrowest id width that fits the vocabulary
+int dataset_write(const char *path, const Vocabulary *v, const uint32_t *tokens, size_t num_tokens)
+{
+    FILE *file = fopen(path, "wb");
+    if (!file)
+    {
+        fprintf(stderr, "Error: Unable to open %s for writing tokens\n", path);
+        return -1;
+    }
+
+    DatasetHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = DATASET_MAGIC;
+    header.version = DATASET_VERSION;
+    header.token_bytes = v->size <= UINT16_MAX + 1 ? sizeof(uint16_t) : sizeof(uint32_t);
+    header.vocab_size = (uint32_t)v->size;
+    header.vocab_hash = vocabulary_hash(v);
+    header.num_tokens = num_tokens;
+
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    if (header.token_bytes == sizeof(uint16_t))
+    {
+        uint16_t chunk[4096];
+        for (size_t i = 0; ok && i < num_tokens; i += 4096)
+        {
+            size_t n = num_tokens - i < 4096 ? num_tokens - i : 4096;
+            for (size_t j = 0; j < n; j++)
+                chunk[j] = (uint16_t)tokens[i + j];
+            ok = fwrite(chunk, sizeof(uint16_t), n, file) == n;
+        }
+    }
+    else
+    {
+        ok = ok && fwrite(tokens, sizeof(uint32_t), num_tokens, file) == num_tokens;
+    }
+
+    if (fclose(file) != 0 || !ok)
+    {
+        fprintf(stderr, "Error: Failed to write tokens to %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+Dataset *dataset_open(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Error: Unable to open token file %s\n", path);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(DatasetHeader))
+    {
+        fprintf(stderr, "Error: %s is too small to be a token file\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        perror("Failed to map token file");
+        return NULL;
+    }
+
+    Dataset *d = (Dataset *)malloc(sizeof(Dataset));
+    if (!d)
+    {
+        munmap(mapping, st.st_size);
+        return NULL;
+    }
+    memcpy(&d->header, mapping, sizeof(DatasetHeader));
+    d->mapping = mapping;
+    d->mapping_size = st.st_size;
+    d->tokens = (const char *)mapping + sizeof(DatasetHeader);
+
+    const DatasetHeader *h = &d->header;
+    int valid = h->magic == DATASET_MAGIC && h->version == DATASET_VERSION &&
+                (h->token_bytes == sizeof(uint16_t) || h->token_bytes == sizeof(uint32_t)) &&
+                h->num_tokens <= (d->mapping_size - sizeof(DatasetHeader)) / h->token_bytes;
+    if (!valid)
+    {
+        fprintf(stderr, "Error: %s is not a valid token file\n", path);
+        dataset_close(d);
+        return NULL;
+    }
+
+    // Windows are visited in shuffled order, so let the kernel read ahead eagerly
+    madvise(mapping, d->mapping_size, MADV_WILLNEED);
+    return d;
+}
+
+void dataset_close(Dataset *d)
+{
+    if (d)
+    {
+        munmap(d->mapping, d->mapping_size);
+        free(d);
+    }
+}
+
+// Consumers index weights by token id, so every reader checks the ids it is
+// about to use; a file is never scanned as a whole just to open it
+static int check_token(const Dataset *d, size_t position, uint32_t id)
+{
+    if (id < d->header.vocab_size)
+        return 0;
+    fprintf(stderr, "Error: Token file has id %u at position %zu, outside its vocabulary of %u\n", id, position,
+            d->header.vocab_size);
+    return -1;
+}
+
+int dataset_check_tokens(const Dataset *d, size_t begin, size_t end)
+{
+    for (size_t t = begin; t < end; t++)
+    {
+        if (check_token(d, t, dataset_token(d, t)) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static uint64_t xorshift64(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static void shuffle_windows(DatasetIterator *it)
+{
+    for (size_t i = it->num_windows; i > 1; i--)
+    {
+        size_t j = xorshift64(&it->rng) % i;
+        size_t tmp = it->order[i - 1];
+        it->order[i - 1] = it->order[j];
+        it->order[j] = tmp;
+    }
+}
+
+// Fill one batch from the current shuffled order, reshuffling at epoch end.
+// Returns -1 at a window holding an id outside the vocabulary.
+static int fill_batch(DatasetIterator *it, DatasetBatch *batch)
+{
+    int n = 0;
+    while (n < it->batch_size && it->cursor < it->num_windows)
+    {
+        size_t start = (it->first_window + it->order[it->cursor++]) * it->seq_len;
+        for (int t = 0; t < it->seq_len; t++)
+        {
+            uint32_t input = dataset_token(it->dataset, start + t);
+            uint32_t target = dataset_token(it->dataset, start + t + 1);
+            if (check_token(it->dataset, start + t, input) != 0 || check_token(it->dataset, start + t + 1, target) != 0)
+                return -1;
+            batch->inputs[n * it->seq_len + t] = input;
+            batch->targets[n * it->seq_len + t] = target;
+        }
+        n++;
+    }
+
+    batch->batch_size = n;
+    batch->epoch = it->epoch;
+    batch->last_in_epoch = it->cursor == it->num_windows;
+
+    if (batch->last_in_epoch)
+    {
+        it->cursor = 0;
+        it->epoch++;
+        shuffle_windows(it);
+    }
+    return 0;
+}
+
+static void *prefetch_thread(void *arg)
+{
+    DatasetIterator *it = (DatasetIterator *)arg;
+
+    pthread_mutex_lock(&it->lock);
+    while (!it->stop)
+    {
+        if (it->count == it->num_slots)
+        {
+            pthread_cond_wait(&it->not_full, &it->lock);
+            continue;
+        }
+
+        // The consumer never touches the tail slot, so fill it unlocked
+        DatasetBatch *batch = &it->slots[it->tail];
+        pthread_mutex_unlock(&it->lock);
+        int status = fill_batch(it, batch);
+        pthread_mutex_lock(&it->lock);
+        if (status != 0)
+        {
+            // Batches already filled are still handed out, then next returns NULL
+            it->failed = 1;
+            pthread_cond_signal(&it->not_empty);
+            break;
+        }
+
+        it->tail = (it->tail + 1) % it->num_slots;
+        it->count++;
+        pthread_cond_signal(&it->not_empty);
+    }
+    pthread_mutex_unlock(&it->lock);
+    return NULL;
+}
+
+DatasetIterator *dataset_iterator_create(const Dataset *d, int seq_len, int batch_size, int prefetch, uint64_t seed)
+{
+    return dataset_iterator_create_sharded(d, seq_len, batch_size, prefetch, seed, 0, 1);
+}
+
+// Iterate over one of num_shards contiguous, equally sized ranges of windows.
+// Every shard has the same number of windows so that workers stay in step.
+DatasetIterator *dataset_iterator_create_sharded(const Dataset *d, int seq_len, int batch_size, int prefetch,
+                                                 uint64_t seed, int shard, int num_shards)
+{
+    size_t total_windows = seq_len > 0 && d->header.num_tokens > 0 ? (d->header.num_tokens - 1) / seq_len : 0;
+    size_t shard_windows = num_shards > 0 ? total_windows / num_shards : 0;
+    if (seq_len < 1 || batch_size < 1 || prefetch < 1 || shard < 0 || shard >= num_shards || shard_windows == 0)
+    {
+        fprintf(stderr, "Error: Dataset too small for %d shard(s) of %d token windows\n", num_shards, seq_len);
+        return NULL;
+    }
+
+    DatasetIterator *it = (DatasetIterator *)calloc(1, sizeof(DatasetIterator));
+    if (!it)
+        return NULL;
+
+    it->dataset = d;
+    it->seq_len = seq_len;
+    it->batch_size = batch_size;
+    it->first_window = shard_windows * shard;
+    it->num_windows = shard_windows;
+    it->rng = seed ? seed : 0x9E3779B97F4A7C15ull;
+    it->num_slots = prefetch;
+
+    it->order = (size_t *)malloc(it->num_windows * sizeof(size_t));
+    it->slots = (DatasetBatch *)calloc(prefetch, sizeof(DatasetBatch));
+    if (!it->order || !it->slots)
+    {
+        fprintf(stderr, "Error: Unable to allocate memory for dataset iterator\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < it->num_windows; i++)
+        it->order[i] = i;
+    shuffle_windows(it);
+
+    for (int i = 0; i < prefetch; i++)
+    {
+        it->slots[i].seq_len = seq_len;
+        it->slots[i].inputs = (uint32_t *)malloc((size_t)batch_size * seq_len * sizeof(uint32_t));
+        it->slots[i].targets = (uint32_t *)malloc((size_t)batch_size * seq_len * sizeof(uint32_t));
+        if (!it->slots[i].inputs || !it->slots[i].targets)
+        {
+            fprintf(stderr, "Error: Unable to allocate memory for dataset batches\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_mutex_init(&it->lock, NULL);
+    pthread_cond_init(&it->not_empty, NULL);
+    pthread_cond_init(&it->not_full, NULL);
+    if (pthread_create(&it->thread, NULL, prefetch_thread, it) != 0)
+    {
+        fprintf(stderr, "Error: Unable to start prefetch thread\n");
+        exit(EXIT_FAILURE);
+    }
+    return it;
+}
+
+// Returns the next prefetched batch; it stays valid until released. Returns
+// NULL once a window with an id outside the vocabulary has been reached.
+DatasetBatch *dataset_iterator_next(DatasetIterator *it)
+{
+    pthread_mutex_lock(&it->lock);
+    while (it->count == 0 && !it->failed)
+        pthread_cond_wait(&it->not_empty, &it->lock);
+    DatasetBatch *batch = it->count > 0 ? &it->slots[it->head] : NULL;
+    pthread_mutex_unlock(&it->lock);
+    return batch;
+}
+
+void dataset_iterator_release(DatasetIterator *it, DatasetBatch *batch)
+{
+    pthread_mutex_lock(&it->lock);
+    if (batch == &it->slots[it->head])
+    {
+        it->head = (it->head + 1) % it->num_slots;
+        it->count--;
+        pthread_cond_signal(&it->not_full);
+    }
+    pthread_mutex_unlock(&it->lock);
+}
+
+void dataset_iterator_free(DatasetIterator *it)
+{
+    if (!it)
+        return;
+
+    pthread_mutex_lock(&it->lock);
+    it->stop = 1;
+    pthread_cond_signal(&it->not_full);
+    pthread_mutex_unlock(&it->lock);
+    pthread_join(it->thread, NULL);
+
+    for (int i = 0; i < it->num_slots; i++)
+    {
+        free(it->slots[i].inputs);
+        free(it->slots[i].targets);
+    }
+    free(it->slots);
+    free(it->order);
+    pthread_mutex_destroy(&it->lock);
+    pthread_cond_destroy(&it->not_empty);
+    pthread_cond_destroy(&it->not_full);
+    free(it);
+}
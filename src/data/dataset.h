@@ -0,0 +1,92 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "../vocabulary/vocabulary.h"
+
+#define DATASET_MAGIC 0x544E4E52u // "RNNT" in little-endian byte order
+#define DATASET_VERSION 1
+
+// On-disk header of a pre-tokenized dataset file, followed by num_tokens ids
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t token_bytes; // Width of each token id: 2 (uint16) or 4 (uint32)
+    uint32_t vocab_size;  // Size of the vocabulary used for encoding
+    uint64_t vocab_hash;  // vocabulary_hash() of that vocabulary
+    uint64_t num_tokens;  // Number of token ids following the header
+} DatasetHeader;
+
+// Read-only, memory-mapped view of a token file
+typedef struct
+{
+    DatasetHeader header;
+    const void *tokens;  // Start of the token ids inside the mapping
+    void *mapping;       // Whole mapped file
+    size_t mapping_size; // Size of the mapping in bytes
+} Dataset;
+
+// A batch of (input, target) windows; target is input shifted by one token
+typedef struct
+{
+    uint32_t *inputs;  // batch_size * seq_len ids, window after window
+    uint32_t *targets; // batch_size * seq_len ids, window after window
+    int batch_size;    // Number of windows filled (the last batch may be short)
+    int seq_len;       // Tokens per window
+    int epoch;         // Epoch this batch belongs to
+    int last_in_epoch; // Non-zero for the final batch of an epoch
+} DatasetBatch;
+
+// Shuffled batch iterator with a background prefetch thread
+typedef struct
+{
+    const Dataset *dataset;
+    int seq_len;
+    int batch_size;
+    size_t first_window; // First window of this iterator's shard
+    size_t num_windows;  // Number of non-overlapping windows in the shard
+    size_t *order;       // Window indices in the current shuffled order
+    size_t cursor;      // Next position in order to be batched
+    int epoch;          // Epoch currently being produced
+    uint64_t rng;       // Shuffle state
+
+    DatasetBatch *slots; // Ring buffer of prefetched batches
+    int num_slots;
+    int head;  // Next slot handed to the consumer
+    int tail;  // Next slot filled by the producer
+    int count; // Number of filled slots
+    int stop;  // Set to ask the producer thread to exit
+    int failed; // Set by the producer at a window with an invalid token id
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} DatasetIterator;
+
+// Tokenization and writing
+uint32_t *dataset_tokenize(Vocabulary *v, const char *text, size_t *num_tokens);
+int dataset_write(const char *path, const Vocabulary *v, const uint32_t *tokens, size_t num_tokens);
+
+// Memory-mapped loading. Token ids are not checked when a file is opened:
+// the iterator checks every window it fills, and other readers call
+// dataset_check_tokens on the range they read.
+Dataset *dataset_open(const char *path);
+void dataset_close(Dataset *d);
+int dataset_check_tokens(const Dataset *d, size_t begin, size_t end); // 0 if ids in [begin, end) fit the vocabulary
+
+static inline uint32_t dataset_token(const Dataset *d, size_t i)
+{
+    if (d->header.token_bytes == sizeof(uint16_t))
+        return ((const uint16_t *)d->tokens)[i];
+    return ((const uint32_t *)d->tokens)[i];
+}
+
+// Shuffled, prefetched iteration
+DatasetIterator *dataset_iterator_create(const Dataset *d, int seq_len, int batch_size, int prefetch, uint64_t seed);
+DatasetIterator *dataset_iterator_create_sharded(const Dataset *d, int seq_len, int batch_size, int prefetch,
+                                                 uint64_t seed, int shard, int num_shards);
+DatasetBatch *dataset_iterator_next(DatasetIterator *it);
+void dataset_iterator_release(DatasetIterator *it, DatasetBatch *batch);
+void dataset_iterator_free(DatasetIterator *it);
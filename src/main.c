@@ -1,11 +1,1306 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
 #include "model/rnn.h"
+#include "model/evaluate.h"
+#include "model/ngram.h"
+#include "model/speculative.h"
 #include "vocabulary/vocabulary.h"
+#include "data/dataset.h"
+#include "tokenizer/bpe.h"
+#include "parallel/data_parallel.h"
+#include "server/server.h"
 
-int main()
+#define TRAINING_TOKENS_PATH "dist/training.tok"
+#define MODEL_PATH "dist/model.rnn"
+#define VOCABULARY_PATH "dist/model.vocab"
+#define DEFAULT_TRAIN_PORT 29500
+#define DEFAULT_SERVE_PORT 29600
+#define MAX_WORKERS 256
+#define PRUNE_EVAL_TOKENS 20000
+#define PRUNE_BENCH_REPEATS 2000
+
+// Read a whole file into a NUL terminated buffer
+static char *read_text_file(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "Error: Unable to open %s\n", path);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *text = (char *)malloc(size + 1);
+    if (!text || fread(text, 1, size, file) != (size_t)size)
+    {
+        fprintf(stderr, "Error: Unable to read %s\n", path);
+        free(text);
+        fclose(file);
+        return NULL;
+    }
+    text[size] = '\0';
+    fclose(file);
+    return text;
+}
+
+// Upper bound on the number of distinct words, used to size the vocabulary
+static int count_words(const char *text)
+{
+    int count = 0;
+    int in_word = 0;
+    for (const char *p = text; *p; p++)
+    {
+        if (isspace((unsigned char)*p))
+            in_word = 0;
+        else if (!in_word)
+        {
+            in_word = 1;
+            count++;
+        }
+    }
+    return count;
+}
+
+// Turn a one-hot input vector into the encoding of the given token id
+static void set_one_hot(Matrix *m, uint32_t id)
+{
+    matrix_fill(m, 0.0);
+    m->entries[id][0] = 1.0;
+}
+
+// rnn tokenize <corpus.txt> <out.tok> [out.vocab]
+static int run_tokenize(int argc, char **argv)
+{
+    if (argc < 4)
+    {
+        fprintf(stderr, "Usage: %s tokenize <corpus.txt> <out.tok> [out.vocab]\n", argv[0]);
+        return 1;
+    }
+
+    char *text = read_text_file(argv[2]);
+    if (!text)
+        return 1;
+
+    Vocabulary *v = vocabulary_create(count_words(text));
+    size_t num_tokens;
+    uint32_t *tokens = dataset_tokenize(v, text, &num_tokens);
+    int status = dataset_write(argv[3], v, tokens, num_tokens);
+    if (status == 0 && argc > 4)
+        status = vocabulary_save(v, argv[4]);
+    if (status == 0)
+        printf("Wrote %zu tokens (vocabulary size %d) to %s\n", num_tokens, v->size, argv[3]);
+
+    free(tokens);
+    free(text);
+    vocabulary_free(v);
+    return status == 0 ? 0 : 1;
+}
+
+// rnn tokenize-bpe <corpus.txt> <vocab_size> <out.tok> <out.vocab> <out.bpe>
+static int run_tokenize_bpe(int argc, char **argv)
+{
+    if (argc < 7)
+    {
+        fprintf(stderr, "Usage: %s tokenize-bpe <corpus.txt> <vocab_size> <out.tok> <out.vocab> <out.bpe>\n", argv[0]);
+        return 1;
+    }
+
+    char *text = read_text_file(argv[2]);
+    if (!text)
+        return 1;
+
+    Bpe *bpe = bpe_train(text, atoi(argv[3]));
+    Vocabulary *v = bpe ? bpe_build_vocabulary(bpe) : NULL;
+    if (!v)
+    {
+        bpe_free(bpe);
+        free(text);
+        return 1;
+    }
+
+    size_t num_tokens;
+    uint32_t *tokens = bpe_tokenize(bpe, text, &num_tokens);
+    int status = dataset_write(argv[4], v, tokens, num_tokens);
+    if (status == 0)
+        status = vocabulary_save(v, argv[5]);
+    if (status == 0)
+        status = bpe_save(bpe, argv[6]);
+    if (status == 0)
+        printf("Wrote %zu tokens (%d merges, vocabulary size %d) to %s\n", num_tokens, bpe->num_merges, v->size, argv[4]);
+
+    free(tokens);
+    free(text);
+    vocabulary_free(v);
+    bpe_free(bpe);
+    return status == 0 ? 0 : 1;
+}
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Prompt token ids: subword tokens when the model was trained on BPE, one id per word otherwise
+static int *encode_prompt(Vocabulary *v, const Bpe *bpe, const char *prompt, int *count)
+{
+    *count = 0;
+    if (bpe)
+    {
+        size_t num_tokens;
+        uint32_t *ids = bpe_tokenize(bpe, prompt, &num_tokens);
+        int *tokens = (int *)malloc((num_tokens + 1) * sizeof(int));
+        if (tokens)
+        {
+            for (size_t i = 0; i < num_tokens; i++)
+            {
+                if (ids[i] != VOCAB_EOS)
+                    tokens[(*count)++] = (int)ids[i];
+            }
+        }
+        free(ids);
+        return tokens;
+    }
+
+    int *tokens = (int *)malloc((count_words(prompt) + 1) * sizeof(int));
+    char *copy = strdup(prompt);
+    if (!tokens || !copy)
+    {
+        free(tokens);
+        free(copy);
+        return NULL;
+    }
+    char *save = NULL;
+    for (char *word = strtok_r(copy, " \t\r\n", &save); word; word = strtok_r(NULL, " \t\r\n", &save))
+    {
+        int token = vocabulary_get_index(v, word);
+        tokens[(*count)++] = token < 0 ? VOCAB_UNK : token;
+    }
+    free(copy);
+    return tokens;
+}
+
+// Generated ids as text: decoded subwords, or the words joined by spaces
+static void print_generated(Vocabulary *v, const Bpe *bpe, const int *tokens, int length)
+{
+    printf("Next word predictions:");
+    if (bpe)
+    {
+        uint32_t *ids = (uint32_t *)malloc(length * sizeof(uint32_t));
+        if (ids)
+        {
+            for (int i = 0; i < length; i++)
+                ids[i] = (uint32_t)tokens[i];
+            char *text = bpe_decode(bpe, ids, length);
+            printf(" %s", text);
+            free(text);
+            free(ids);
+        }
+    }
+    else
+    {
+        for (int i = 0; i < length; i++)
+            printf(" %s", vocabulary_get_word(v, tokens[i]));
+    }
+    printf("\n");
+}
+
+// Feed all but the last prompt token; generation starts from the last one
+static int feed_prompt(const RNN *rnn, RNNState *state, const int *prompt, int count)
+{
+    rnn_state_restore(rnn, state);
+    for (int i = 0; i + 1 < count; i++)
+        rnn_step(rnn, state, prompt[i]);
+    return prompt[count - 1];
+}
+
+// Greedy generation through the forward-only path, for prompts of several tokens
+static int generate_tokens(RNN *rnn, Vocabulary *v, const Bpe *bpe, const char *prompt, const int *ids, int count,
+                           int length)
+{
+    int *tokens = (int *)malloc(length * sizeof(int));
+    if (!tokens)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+    RNNState *state = rnn_state_create(rnn);
+    int token = feed_prompt(rnn, state, ids, count);
+    rnn_generate_tokens(rnn, state, token, length, tokens);
+    printf("Input text: %s\n", prompt);
+    print_generated(v, bpe, tokens, length);
+    rnn_state_free(state);
+    free(tokens);
+    return 0;
+}
+
+// Generate with an n-gram draft, check the result against plain greedy decoding and report both
+static int generate_speculative(RNN *rnn, Vocabulary *v, const Bpe *bpe, const char *prompt, const int *ids,
+                                int count, int length, const char *draft_path, int order, int draft_length)
+{
+    Dataset *dataset = dataset_open(draft_path);
+    if (!dataset)
+        return 1;
+    if (dataset->header.vocab_hash != vocabulary_hash(v))
+    {
+        fprintf(stderr, "Error: %s was not encoded with this vocabulary\n", draft_path);
+        dataset_close(dataset);
+        return 1;
+    }
+    double start = now_seconds();
+    NgramModel *draft = ngram_build(dataset, order);
+    double build_seconds = now_seconds() - start;
+    dataset_close(dataset);
+    if (!draft)
+        return 1;
+
+    int *greedy = (int *)malloc(length * sizeof(int));
+    int *speculative = (int *)malloc(length * sizeof(int));
+    if (!greedy || !speculative)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        free(greedy);
+        free(speculative);
+        ngram_free(draft);
+        return 1;
+    }
+
+    RNNState *state = rnn_state_create(rnn);
+    int token = feed_prompt(rnn, state, ids, count);
+    start = now_seconds();
+    rnn_generate_tokens(rnn, state, token, length, greedy);
+    double greedy_seconds = now_seconds() - start;
+
+    SpeculativeStats stats = {0, 0, 0, 0};
+    feed_prompt(rnn, state, ids, count);
+    start = now_seconds();
+    speculative_generate(rnn, draft, state, token, length, draft_length, speculative, &stats);
+    double speculative_seconds = now_seconds() - start;
+
+    printf("Input text: %s\n", prompt);
+    print_generated(v, bpe, speculative, length);
+
+    int identical = memcmp(greedy, speculative, length * sizeof(int)) == 0;
+    printf("Draft: order %d, %d tokens ahead, built in %.3fs\n", order, draft_length - 1, build_seconds);
+    printf("Acceptance rate %.1f%% (%ld of %ld drafted), %.2f tokens per RNN pass\n",
+           stats.drafted ? 100.0 * stats.accepted / stats.drafted : 0.0, stats.accepted, stats.drafted,
+           stats.passes ? (double)stats.tokens / stats.passes : 0.0);
+    printf("Greedy %.0f tokens/s, speculative %.0f tokens/s (%.2fx), output %s\n", length / greedy_seconds,
+           length / speculative_seconds, greedy_seconds / speculative_seconds,
+           identical ? "identical" : "DIFFERS from greedy");
+
+    free(greedy);
+    free(speculative);
+    rnn_state_free(state);
+    ngram_free(draft);
+    return identical ? 0 : 1;
+}
+
+// rnn generate <model> <vocab> <prompt> [length] [--bpe merges] [--draft tokens] [--draft-order N]
+//              [--draft-length K]
+static int run_generate(int argc, char **argv)
+{
+    if (argc < 5)
+    {
+        fprintf(stderr,
+                "Usage: %s generate <model> <vocab> <prompt> [length] [--bpe merges] [--draft tokens] "
+                "[--draft-order N] [--draft-length K]\n",
+                argv[0]);
+        return 1;
+    }
+
+    int length = 5;
+    const char *bpe_path = NULL;
+    const char *draft_path = NULL;
+    int draft_order = 4;
+    int draft_length = 8;
+    int i = 5;
+    if (argc > 5 && strncmp(argv[5], "--", 2) != 0)
+        length = atoi(argv[i++]);
+    for (; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--bpe") == 0)
+            bpe_path = argv[i + 1];
+        else if (strcmp(argv[i], "--draft") == 0)
+            draft_path = argv[i + 1];
+        else if (strcmp(argv[i], "--draft-order") == 0)
+            draft_order = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--draft-length") == 0)
+            draft_length = atoi(argv[i + 1]);
+        else
+        {
+            fprintf(stderr, "Error: Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (length < 1 || draft_length < 1)
+    {
+        fprintf(stderr, "Error: Invalid generation options\n");
+        return 1;
+    }
+
+    Vocabulary *v = vocabulary_load(argv[3]);
+    if (!v)
+        return 1;
+    RNN *rnn = rnn_load(argv[2]);
+    if (rnn->output_size != v->size)
+    {
+        fprintf(stderr, "Error: Model expects %d words but vocabulary has %d\n", rnn->output_size, v->size);
+        rnn_free(rnn);
+        vocabulary_free(v);
+        return 1;
+    }
+
+    // A BPE model's vocabulary holds subwords, so prompts and output go through the merges
+    Bpe *bpe = NULL;
+    if (bpe_path)
+    {
+        bpe = bpe_load(bpe_path);
+        if (!bpe || bpe->num_tokens != v->size)
+        {
+            if (bpe)
+                fprintf(stderr, "Error: %s has %d tokens but the vocabulary has %d\n", bpe_path, bpe->num_tokens,
+                        v->size);
+            bpe_free(bpe);
+            rnn_free(rnn);
+            vocabulary_free(v);
+            return 1;
+        }
+    }
+
+    rnn_autotune(rnn, stdout);
+    int status = 0;
+    int count = 0;
+    int *ids = encode_prompt(v, bpe, argv[4], &count);
+    if (!ids || count == 0)
+    {
+        fprintf(stderr, "Error: Empty prompt\n");
+        status = 1;
+    }
+    else if (draft_path)
+        status = generate_speculative(rnn, v, bpe, argv[4], ids, count, length, draft_path, draft_order, draft_length);
+    else if (bpe || count > 1)
+        status = generate_tokens(rnn, v, bpe, argv[4], ids, count, length);
+    else
+    {
+        char *next_word_predictions = rnn_generate_text(v, rnn, argv[4], length);
+        printf("Input text: %s\n", argv[4]);
+        printf("Next word predictions: %s\n", next_word_predictions);
+        free(next_word_predictions);
+    }
+
+    free(ids);
+    bpe_free(bpe);
+    rnn_free(rnn);
+    vocabulary_free(v);
+    if (matrix_memory_report_leaks(stderr) != 0)
+        status = 1;
+    return status;
+}
+
+// rnn train <tokens> <vocab> <model> [options]
+static int run_train(int argc, char **argv)
+{
+    if (argc < 5)
+    {
+        fprintf(stderr,
+                "Usage: %s train <tokens> <vocab> <model> [--hidden N] [--epochs N] [--lr X] [--batch N]\n"
+                "       [--seq-len T] [--checkpoint K] [--output-rank R] [--workers N] [--sync K] [--no-overlap]\n"
+                "       [--port P] [--rank R --hosts host:port,...]\n",
+                argv[0]);
+        return 1;
+    }
+
+    TrainConfig config = {
+        .tokens_path = argv[2],
+        .vocab_path = argv[3],
+        .model_path = argv[4],
+        .hidden_size = 100,
+        .output_rank = 0,
+        .epochs = 200,
+        .learning_rate = 0.01,
+        .batch_size = 16,
+        .seq_len = 1,
+        .checkpoint_every = 0,
+        .sync_steps = 1,
+        .overlap = 1,
+        .rank = 0,
+        .world_size = 1,
+        .seed = 42,
+    };
+    int port = DEFAULT_TRAIN_PORT;
+    char *hosts = NULL;
+
+    for (int i = 5; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "--no-overlap") == 0)
+        {
+            config.overlap = 0;
+            continue;
+        }
+        if (!value)
+        {
+            fprintf(stderr, "Error: Missing value for %s\n", arg);
+            return 1;
+        }
+        i++;
+        if (strcmp(arg, "--hidden") == 0)
+            config.hidden_size = atoi(value);
+        else if (strcmp(arg, "--output-rank") == 0)
+            config.output_rank = atoi(value);
+        else if (strcmp(arg, "--epochs") == 0)
+            config.epochs = atoi(value);
+        else if (strcmp(arg, "--lr") == 0)
+            config.learning_rate = atof(value);
+        else if (strcmp(arg, "--batch") == 0)
+            config.batch_size = atoi(value);
+        else if (strcmp(arg, "--seq-len") == 0)
+            config.seq_len = atoi(value);
+        else if (strcmp(arg, "--checkpoint") == 0)
+            config.checkpoint_every = atoi(value);
+        else if (strcmp(arg, "--workers") == 0)
+            config.world_size = atoi(value);
+        else if (strcmp(arg, "--sync") == 0)
+            config.sync_steps = atoi(value);
+        else if (strcmp(arg, "--port") == 0)
+            port = atoi(value);
+        else if (strcmp(arg, "--rank") == 0)
+            config.rank = atoi(value);
+        else if (strcmp(arg, "--hosts") == 0)
+            hosts = strdup(value);
+        else
+        {
+            fprintf(stderr, "Error: Unknown option %s\n", arg);
+            return 1;
+        }
+    }
+
+    // Either one entry per rank from --hosts (multi-node), or local workers on consecutive ports
+    char *endpoints[MAX_WORKERS];
+    char local_endpoints[MAX_WORKERS][32];
+    int spawn_local = hosts == NULL;
+    if (hosts)
+    {
+        config.world_size = 0;
+        for (char *host = strtok(hosts, ","); host && config.world_size < MAX_WORKERS; host = strtok(NULL, ","))
+            endpoints[config.world_size++] = host;
+    }
+    else
+    {
+        for (int i = 0; i < config.world_size && i < MAX_WORKERS; i++)
+        {
+            snprintf(local_endpoints[i], sizeof(local_endpoints[i]), "127.0.0.1:%d", port + i);
+            endpoints[i] = local_endpoints[i];
+        }
+    }
+    config.endpoints = endpoints;
+
+    if (config.world_size < 1 || config.world_size > MAX_WORKERS || config.rank < 0 ||
+        config.rank >= config.world_size || config.sync_steps < 1 || config.epochs < 1 || config.batch_size < 1 ||
+        config.seq_len < 1 || config.checkpoint_every < 0 || config.output_rank < 0 ||
+        config.output_rank > config.hidden_size)
+    {
+        fprintf(stderr, "Error: Invalid training options\n");
+        free(hosts);
+        return 1;
+    }
+
+    // Fork the local workers; this process becomes rank 0
+    pid_t workers[MAX_WORKERS];
+    int num_workers = 0;
+    if (spawn_local)
+    {
+        fflush(stdout);
+        for (int rank = 1; rank < config.world_size; rank++)
+        {
+            pid_t pid = fork();
+            if (pid < 0)
+            {
+                perror("Failed to start worker");
+                // The workers already running would wait forever for rank 0
+                for (int i = 0; i < num_workers; i++)
+                    kill(workers[i], SIGTERM);
+                for (int i = 0; i < num_workers; i++)
+                    waitpid(workers[i], NULL, 0);
+                free(hosts);
+                return 1;
+            }
+            if (pid == 0)
+            {
+                config.rank = rank;
+                _exit(data_parallel_train(&config) == 0 ? 0 : 1);
+            }
+            workers[num_workers++] = pid;
+        }
+    }
+
+    int status = data_parallel_train(&config);
+    for (int i = 0; i < num_workers; i++)
+    {
+        int worker_status;
+        if (waitpid(workers[i], &worker_status, 0) < 0 || !WIFEXITED(worker_status) || WEXITSTATUS(worker_status) != 0)
+            status = -1;
+    }
+
+    free(hosts);
+    return status == 0 ? 0 : 1;
+}
+
+// Quality and speed of a model over the start of a token stream
+typedef struct
+{
+    double mse;             // Mean square error against the one-hot targets
+    double accuracy;        // Fraction of targets predicted by argmax
+    double agreement;       // Fraction of argmax predictions equal to the reference
+    double token_ms;        // Milliseconds per rnn_forward
+    double projection_us;   // Microseconds per output projection
+} PruneStats;
+
+// Tokens measure_model reads from the start of the stream
+static size_t measured_tokens(const Dataset *dataset)
+{
+    return dataset->header.num_tokens < PRUNE_EVAL_TOKENS ? dataset->header.num_tokens : PRUNE_EVAL_TOKENS;
+}
+
+static void measure_model(RNN *rnn, Dataset *dataset, int *reference, PruneStats *stats)
+{
+    size_t num_tokens = measured_tokens(dataset);
+    Matrix *input = matrix_zero(rnn->input_size, 1);
+    Matrix *target = matrix_zero(rnn->output_size, 1);
+    matrix_fill(rnn->hidden_state, 0.0);
+
+    double mse = 0.0, correct = 0.0, agree = 0.0, elapsed = 0.0;
+    for (size_t t = 0; t + 1 < num_tokens; t++)
+    {
+        set_one_hot(input, dataset_token(dataset, t));
+        set_one_hot(target, dataset_token(dataset, t + 1));
+
+        double start = now_seconds();
+        Matrix *output = rnn_forward(rnn, input);
+        elapsed += now_seconds() - start;
+
+        int predicted = matrix_argmax(output);
+        mse += matrix_mean_square_error(output, target);
+        correct += predicted == (int)dataset_token(dataset, t + 1);
+        if (reference[t] < 0)
+            reference[t] = predicted;
+        agree += predicted == reference[t];
+        matrix_free(output);
+    }
+
+    // Time the output projection alone on the final hidden state
+    double start = now_seconds();
+    for (int r = 0; r < PRUNE_BENCH_REPEATS; r++)
+    {
+        Matrix *output = rnn_output_projection(rnn, rnn->hidden_state);
+        matrix_free(output);
+    }
+    stats->projection_us = (now_seconds() - start) * 1e6 / PRUNE_BENCH_REPEATS;
+
+    size_t steps = num_tokens > 1 ? num_tokens - 1 : 1;
+    stats->mse = mse / steps;
+    stats->accuracy = correct / steps;
+    stats->agreement = agree / steps;
+    stats->token_ms = elapsed * 1e3 / steps;
+    matrix_free(input);
+    matrix_free(target);
+}
+
+// Retrain a pruned model for a few epochs; pruned weights stay zero
+static int finetune_pruned(RNN *rnn, Dataset *dataset, int epochs)
+{
+    DatasetIterator *it = dataset_iterator_create(dataset, 1, 16, 4, 7);
+    if (!it)
+        return -1;
+    rnn_densify_output(rnn);
+    Matrix *input = matrix_zero(rnn->input_size, 1);
+    Matrix *target = matrix_zero(rnn->output_size, 1);
+    int status = 0;
+    for (int epoch = 0; status == 0 && epoch < epochs; epoch++)
+    {
+        int last_in_epoch = 0;
+        while (!last_in_epoch)
+        {
+            DatasetBatch *batch = dataset_iterator_next(it);
+            if (!batch)
+            {
+                status = -1;
+                break;
+            }
+            for (int i = 0; i < batch->batch_size; i++)
+            {
+                set_one_hot(input, batch->inputs[i]);
+                set_one_hot(target, batch->targets[i]);
+                rnn_backward(rnn, input, target);
+            }
+            last_in_epoch = batch->last_in_epoch;
+            dataset_iterator_release(it, batch);
+        }
+    }
+    matrix_free(input);
+    matrix_free(target);
+    dataset_iterator_free(it);
+    return status;
+}
+
+// rnn prune <model> <tokens> <out> [--sparsity S] [--block B] [--finetune N]
+static int run_prune(int argc, char **argv)
+{
+    if (argc < 5)
+    {
+        fprintf(stderr, "Usage: %s prune <model> <tokens> <out> [--sparsity S] [--block B] [--finetune N]\n", argv[0]);
+        return 1;
+    }
+
+    double target_sparsity = 0.9;
+    int block_cols = 1;
+    int finetune_epochs = 0;
+    for (int i = 5; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--sparsity") == 0)
+            target_sparsity = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "--block") == 0)
+            block_cols = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--finetune") == 0)
+            finetune_epochs = atoi(argv[i + 1]);
+        else
+        {
+            fprintf(stderr, "Error: Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    Dataset *dataset = dataset_open(argv[3]);
+    if (!dataset)
+        return 1;
+    RNN *dense = rnn_load(argv[2]);
+    if (dense->input_size != (int)dataset->header.vocab_size || dense->output_left)
+    {
+        fprintf(stderr, "Error: %s needs a dense model matching the token file\n", argv[2]);
+        rnn_free(dense);
+        dataset_close(dataset);
+        return 1;
+    }
+    if (dataset_check_tokens(dataset, 0, measured_tokens(dataset)) != 0)
+    {
+        rnn_free(dense);
+        dataset_close(dataset);
+        return 1;
+    }
+
+    int *reference = (int *)malloc(PRUNE_EVAL_TOKENS * sizeof(int));
+    if (!reference)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        rnn_free(dense);
+        dataset_close(dataset);
+        return 1;
+    }
+    memset(reference, -1, PRUNE_EVAL_TOKENS * sizeof(int));
+
+    PruneStats base;
+    measure_model(dense, dataset, reference, &base);
+    rnn_free(dense);
+    printf("sparsity  ms/token  speedup  proj us  proj speedup  mse       accuracy  agreement\n");
+    printf("%8.2f  %8.4f  %7.2f  %7.2f  %12.2f  %.6f  %8.3f  %9.3f\n", 0.0, base.token_ms, 1.0,
+           base.projection_us, 1.0, base.mse, base.accuracy, base.agreement);
+
+    // Sweep a few sparsities, ending with the target, which is the one saved
+    const double sweep[] = {0.5, 0.7, 0.8, 0.9, 0.95};
+    int num_levels = sizeof(sweep) / sizeof(sweep[0]);
+    for (int level = 0; level <= num_levels; level++)
+    {
+        double sparsity = level < num_levels ? sweep[level] : target_sparsity;
+        if (level < num_levels && sparsity >= target_sparsity)
+            continue;
+
+        RNN *rnn = rnn_load(argv[2]);
+        double reached = rnn_prune_output(rnn, sparsity, block_cols);
+        if (finetune_epochs > 0 && finetune_pruned(rnn, dataset, finetune_epochs) != 0)
+        {
+            rnn_free(rnn);
+            free(reference);
+            dataset_close(dataset);
+            return 1;
+        }
+
+        PruneStats stats;
+        measure_model(rnn, dataset, reference, &stats);
+        printf("%8.2f  %8.4f  %7.2f  %7.2f  %12.2f  %.6f  %8.3f  %9.3f\n", reached, stats.token_ms,
+               base.token_ms / stats.token_ms, stats.projection_us, base.projection_us / stats.projection_us,
+               stats.mse, stats.accuracy, stats.agreement);
+
+        if (level == num_levels)
+            rnn_save(rnn, argv[4]);
+        rnn_free(rnn);
+    }
+
+    free(reference);
+    dataset_close(dataset);
+    return 0;
+}
+
+// rnn factorize <model> <tokens> <out> [--energy E] [--max-rank R]
+static int run_factorize(int argc, char **argv)
+{
+    if (argc < 5)
+    {
+        fprintf(stderr, "Usage: %s factorize <model> <tokens> <out> [--energy E] [--max-rank R]\n", argv[0]);
+        return 1;
+    }
+
+    double energy = 0.9;
+    int max_rank = 0;
+    for (int i = 5; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--energy") == 0)
+            energy = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "--max-rank") == 0)
+            max_rank = atoi(argv[i + 1]);
+        else
+        {
+            fprintf(stderr, "Error: Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    Dataset *dataset = dataset_open(argv[3]);
+    if (!dataset)
+        return 1;
+    RNN *rnn = rnn_load(argv[2]);
+    if (rnn->input_size != (int)dataset->header.vocab_size || rnn->output_left)
+    {
+        fprintf(stderr, "Error: %s needs a dense model matching the token file\n", argv[2]);
+        rnn_free(rnn);
+        dataset_close(dataset);
+        return 1;
+    }
+    if (dataset_check_tokens(dataset, 0, measured_tokens(dataset)) != 0)
+    {
+        rnn_free(rnn);
+        dataset_close(dataset);
+        return 1;
+    }
+
+    int *reference = (int *)malloc(PRUNE_EVAL_TOKENS * sizeof(int));
+    if (!reference)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        rnn_free(rnn);
+        dataset_close(dataset);
+        return 1;
+    }
+    memset(reference, -1, PRUNE_EVAL_TOKENS * sizeof(int));
+
+    PruneStats base, stats;
+    rnn_densify_output(rnn); // A pruned model is compared by its dense size
+    size_t dense_parameters = rnn_parameter_count(rnn);
+    measure_model(rnn, dataset, reference, &base);
+
+    double retained;
+    int rank = rnn_factorize_output(rnn, energy, max_rank, &retained);
+    measure_model(rnn, dataset, reference, &stats);
+    size_t factored_parameters = rnn_parameter_count(rnn);
+
+    printf("rank %d of %d keeps %.1f%% of the spectral energy\n", rank, rnn->hidden_size, retained * 100.0);
+    printf("model     parameters  ms/token  proj us  mse       accuracy  agreement\n");
+    printf("dense     %10zu  %8.4f  %7.2f  %.6f  %8.3f  %9.3f\n", dense_parameters, base.token_ms,
+           base.projection_us, base.mse, base.accuracy, base.agreement);
+    printf("factored  %10zu  %8.4f  %7.2f  %.6f  %8.3f  %9.3f\n", factored_parameters, stats.token_ms,
+           stats.projection_us, stats.mse, stats.accuracy, stats.agreement);
+    printf("projection speedup %.2fx, %.1f%% of the parameters\n", base.projection_us / stats.projection_us,
+           100.0 * factored_parameters / dense_parameters);
+
+    rnn_save(rnn, argv[4]);
+    free(reference);
+    rnn_free(rnn);
+    dataset_close(dataset);
+    return 0;
+}
+
+// rnn evaluate <tokens> <vocab> <model>... [--threads N] [--top-k K]
+static int run_evaluate(int argc, char **argv)
+{
+    if (argc < 5)
+    {
+        fprintf(stderr, "Usage: %s evaluate <tokens> <vocab> <model>... [--threads N] [--top-k K]\n", argv[0]);
+        return 1;
+    }
+
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = online > 0 ? (int)online : 1;
+    int top_k = 5;
+    int num_models = 0;
+    char **models = argv + 4;
+    for (int i = 4; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--top-k") == 0 && i + 1 < argc)
+            top_k = atoi(argv[++i]);
+        else if (strncmp(argv[i], "--", 2) == 0)
+        {
+            fprintf(stderr, "Error: Unknown option %s\n", argv[i]);
+            return 1;
+        }
+        else
+            models[num_models++] = argv[i];
+    }
+
+    Vocabulary *v = vocabulary_load(argv[3]);
+    Dataset *dataset = v ? dataset_open(argv[2]) : NULL;
+    if (!dataset)
+    {
+        vocabulary_free(v);
+        return 1;
+    }
+    // Same size is not enough: ids from another vocabulary would score the wrong words
+    if (dataset->header.vocab_hash != vocabulary_hash(v))
+    {
+        fprintf(stderr, "Error: %s was not encoded with vocabulary %s\n", argv[2], argv[3]);
+        dataset_close(dataset);
+        vocabulary_free(v);
+        return 1;
+    }
+
+    int status = 0;
+    printf("%-32s  %10s  %10s  %8s  %8s  %8s  %12s\n", "model", "perplexity", "cross-ent", "accuracy", "top-k",
+           "threads", "tokens/s");
+    for (int i = 0; i < num_models; i++)
+    {
+        RNN *rnn = rnn_load(models[i]);
+        rnn_autotune(rnn, stderr);
+        EvalResult result;
+        if (evaluate_model(rnn, dataset, threads, top_k, &result) == 0)
+            printf("%-32s  %10.3f  %10.4f  %8.4f  %8.4f  %8d  %12.0f\n", models[i], result.perplexity,
+                   result.cross_entropy, result.accuracy, result.top_k_accuracy, result.threads,
+                   result.tokens_per_second);
+        else
+            status = 1;
+        rnn_free(rnn);
+    }
+
+    dataset_close(dataset);
+    vocabulary_free(v);
+    return status;
+}
+
+// rnn bptt <model> <tokens> [--seq-len T] [--windows N]
+// Backpropagates the same windows under each checkpoint policy and reports
+// activation memory and time; the gradients must come out identical
+static int run_bptt(int argc, char **argv)
+{
+    if (argc < 4)
+    {
+        fprintf(stderr, "Usage: %s bptt <model> <tokens> [--seq-len T] [--windows N]\n", argv[0]);
+        return 1;
+    }
+
+    int seq_len = 256;
+    int windows = 8;
+    for (int i = 4; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--seq-len") == 0)
+            seq_len = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--windows") == 0)
+            windows = atoi(argv[i + 1]);
+        else
+        {
+            fprintf(stderr, "Error: Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    // The token file is checked before the model is loaded, so bad arguments fail fast
+    Dataset *dataset = dataset_open(argv[3]);
+    if (!dataset)
+        return 1;
+    size_t available = dataset->header.num_tokens > 0 && seq_len > 0 ? (dataset->header.num_tokens - 1) / seq_len : 0;
+    if (seq_len < 1 || windows < 1 || available == 0)
+    {
+        fprintf(stderr, "Error: Need at least one window of %d tokens\n", seq_len);
+        dataset_close(dataset);
+        return 1;
+    }
+    if ((size_t)windows > available)
+        windows = (int)available;
+    if (dataset_check_tokens(dataset, 0, (size_t)windows * seq_len + 1) != 0)
+    {
+        dataset_close(dataset);
+        return 1;
+    }
+
+    int status = 1;
+    uint32_t *inputs = NULL, *targets = NULL;
+    RNNGradients *grads = NULL;
+    double *reference = NULL, *packed = NULL;
+    RNN *rnn = rnn_load(argv[2]);
+    if ((int)dataset->header.vocab_size != rnn->input_size)
+    {
+        fprintf(stderr, "Error: %s was not encoded with the model's vocabulary\n", argv[3]);
+        goto cleanup;
+    }
+    rnn_densify_output(rnn);
+
+    size_t num_tokens = (size_t)windows * seq_len;
+    inputs = (uint32_t *)malloc(num_tokens * sizeof(uint32_t));
+    targets = (uint32_t *)malloc(num_tokens * sizeof(uint32_t));
+    grads = rnn_gradients_create(rnn);
+    size_t count = rnn_gradients_size(grads);
+    reference = (double *)malloc(count * sizeof(double));
+    packed = (double *)malloc(count * sizeof(double));
+    if (!inputs || !targets || !reference || !packed)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        goto cleanup;
+    }
+    for (size_t t = 0; t < num_tokens; t++)
+    {
+        inputs[t] = dataset_token(dataset, t);
+        targets[t] = dataset_token(dataset, t + 1);
+    }
+
+    const char *names[] = {"store all", "sqrt(T)", "one checkpoint"};
+    int policies[] = {1, 0, seq_len};
+    status = 0;
+    printf("%d windows of %d tokens, hidden size %d\n", windows, seq_len, rnn->hidden_size);
+    printf("%-16s  %6s  %14s  %10s  %8s  %10s  %s\n", "policy", "k", "activations", "recomputed", "seconds",
+           "tokens/s", "gradients");
+    for (int p = 0; p < 3; p++)
+    {
+        RNNBptt *bptt = rnn_bptt_create(rnn, seq_len, policies[p]);
+        rnn_gradients_zero(grads);
+        double start = now_seconds();
+        for (int w = 0; w < windows; w++)
+            rnn_bptt_accumulate(rnn, bptt, inputs + (size_t)w * seq_len, targets + (size_t)w * seq_len, grads);
+        double seconds = now_seconds() - start;
+
+        rnn_gradients_pack(grads, p == 0 ? reference : packed);
+        int identical = p == 0 || memcmp(reference, packed, count * sizeof(double)) == 0;
+        if (!identical)
+            status = 1;
+        printf("%-16s  %6d  %10.1f KiB  %10ld  %8.3f  %10.0f  %s\n", names[p], bptt->checkpoint_every,
+               rnn_bptt_activation_bytes(rnn, bptt) / 1024.0, bptt->recomputed_steps, seconds, num_tokens / seconds,
+               p == 0 ? "reference" : identical ? "identical" : "DIFFER");
+        rnn_bptt_free(bptt);
+    }
+
+cleanup:
+    free(inputs);
+    free(targets);
+    free(reference);
+    free(packed);
+    rnn_gradients_free(grads);
+    dataset_close(dataset);
+    rnn_free(rnn);
+    return status;
+}
+
+// One SGD step on (input -> target)
+static double update_step(RNN *rnn, Matrix *input, Matrix *target, uint32_t from, uint32_t to)
+{
+    set_one_hot(input, from);
+    set_one_hot(target, to);
+    return rnn_backward(rnn, input, target);
+}
+
+// rnn update <model> <vocab> <text|-> <out model> <out vocab> [--epochs N] [--lr X] [--bpe merges]
+static int run_update(int argc, char **argv)
 {
+    if (argc < 7)
+    {
+        fprintf(stderr,
+                "Usage: %s update <model> <vocab> <text|-> <out model> <out vocab> [--epochs N] [--lr X] "
+                "[--bpe merges]\n",
+                argv[0]);
+        return 1;
+    }
+
+    int epochs = 1;
+    double learning_rate = 0.0;
+    const char *bpe_path = NULL;
+    for (int i = 7; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--epochs") == 0)
+            epochs = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--lr") == 0)
+            learning_rate = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "--bpe") == 0)
+            bpe_path = argv[i + 1];
+        else
+        {
+            fprintf(stderr, "Error: Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    // Everything below is released at cleanup, whichever way the update ends
+    int status = 1;
+    FILE *text = NULL;
+    uint32_t *stream = NULL;
+    Matrix *input = NULL, *target = NULL;
+    Bpe *bpe = NULL;
+    char *line = NULL;
+    size_t line_capacity = 0;
+
+    RNN *rnn = rnn_load(argv[2]);
+    Vocabulary *v = vocabulary_load(argv[3]);
+    if (!v)
+        goto cleanup;
+    if (v->size != rnn->input_size || rnn->input_size != rnn->output_size)
+    {
+        fprintf(stderr, "Error: Model has %d inputs and %d outputs but the vocabulary has %d words\n",
+                rnn->input_size, rnn->output_size, v->size);
+        goto cleanup;
+    }
+    if (learning_rate > 0.0)
+        rnn->learning_rate = learning_rate;
+    rnn_densify_output(rnn);
+
+    // A BPE vocabulary is fixed by its merges: new text is encoded into the
+    // existing subwords and nothing grows
+    if (bpe_path)
+    {
+        bpe = bpe_load(bpe_path);
+        if (!bpe)
+            goto cleanup;
+        if (bpe->num_tokens != v->size)
+        {
+            fprintf(stderr, "Error: %s has %d tokens but the vocabulary has %d\n", bpe_path, bpe->num_tokens,
+                    v->size);
+            goto cleanup;
+        }
+    }
+    else if (vocabulary_get_index(v, " ") != -1)
+    {
+        // Only a BPE vocabulary has the space byte token; whitespace splitting never adds it
+        fprintf(stderr, "Error: %s is a BPE vocabulary, pass its merges with --bpe\n", argv[3]);
+        goto cleanup;
+    }
+
+    text = strcmp(argv[4], "-") == 0 ? stdin : fopen(argv[4], "r");
+    if (!text)
+    {
+        fprintf(stderr, "Error: Unable to open %s\n", argv[4]);
+        goto cleanup;
+    }
+
+    // Tokens seen so far, replayed for the epochs after the first
+    size_t num_tokens = 0, token_capacity = 1024;
+    stream = (uint32_t *)malloc(token_capacity * sizeof(uint32_t));
+    if (!stream)
+    {
+        fprintf(stderr, "Error: Unable to allocate memory for tokens\n");
+        goto cleanup;
+    }
+
+    int initial_size = v->size;
+    input = matrix_zero(rnn->input_size, 1);
+    target = matrix_zero(rnn->output_size, 1);
+    double start = now_seconds();
+
+    // First epoch: read the text a line at a time, growing the vocabulary and
+    // the model as new words show up and training on each line right away
+    uint32_t previous = VOCAB_EOS;
+    double loss = 0.0;
+    size_t lines = 0;
+    while (getline(&line, &line_capacity, text) != -1)
+    {
+        int words = count_words(line);
+        if (words == 0)
+            continue;
+        if (!bpe && v->size + words > v->capacity)
+        {
+            int capacity = v->capacity * 2 > v->size + words ? v->capacity * 2 : v->size + words;
+            if (vocabulary_reserve(v, capacity) != 0)
+                goto cleanup;
+        }
+
+        size_t count;
+        uint32_t *tokens = bpe ? bpe_tokenize(bpe, line, &count) : dataset_tokenize(v, line, &count);
+        if (v->size > rnn->input_size)
+        {
+            rnn_grow_vocabulary(rnn, v->size);
+            matrix_resize(input, v->size, 1);
+            matrix_resize(target, v->size, 1);
+        }
+
+        for (size_t t = 0; t < count; t++)
+        {
+            loss += update_step(rnn, input, target, previous, tokens[t]);
+            previous = tokens[t];
+        }
+
+        if (num_tokens + count > token_capacity)
+        {
+            while (num_tokens + count > token_capacity)
+                token_capacity *= 2;
+            uint32_t *grown = (uint32_t *)realloc(stream, token_capacity * sizeof(uint32_t));
+            if (!grown)
+            {
+                fprintf(stderr, "Error: Unable to allocate memory for tokens\n");
+                free(tokens);
+                goto cleanup;
+            }
+            stream = grown;
+        }
+        memcpy(stream + num_tokens, tokens, count * sizeof(uint32_t));
+        num_tokens += count;
+        free(tokens);
+        lines++;
+    }
+
+    printf("Epoch 1: %zu lines, %zu tokens, %d new words, loss %.6f\n", lines, num_tokens, v->size - initial_size,
+           num_tokens ? loss / num_tokens : 0.0);
+    for (int epoch = 1; epoch < epochs; epoch++)
+    {
+        loss = 0.0;
+        for (size_t t = 0; t < num_tokens; t++)
+        {
+            loss += update_step(rnn, input, target, previous, stream[t]);
+            previous = stream[t];
+        }
+        printf("Epoch %d: loss %.6f\n", epoch + 1, num_tokens ? loss / num_tokens : 0.0);
+    }
+
+    double seconds = now_seconds() - start;
+    printf("Vocabulary %d -> %d words, updated in %.2fs (%.0f tokens/s)\n", initial_size, v->size, seconds,
+           seconds > 0.0 ? num_tokens * epochs / seconds : 0.0);
+
+    rnn_save(rnn, argv[5]);
+    status = vocabulary_save(v, argv[6]) == 0 ? 0 : 1;
+
+cleanup:
+    free(line);
+    if (text && text != stdin)
+        fclose(text);
+    free(stream);
+    matrix_free(input);
+    matrix_free(target);
+    bpe_free(bpe);
+    vocabulary_free(v);
+    rnn_free(rnn);
+    return status;
+}
+
+// rnn serve <model> <vocab> [--socket PATH | --port P] [--workers N] [--queue N] [--max-length N] [--bpe merges]
+static int run_serve(int argc, char **argv)
+{
+    if (argc < 4)
+    {
+        fprintf(stderr,
+                "Usage: %s serve <model> <vocab> [--socket PATH | --port P] [--workers N] [--queue N] "
+                "[--max-length N] [--bpe merges]\n",
+                argv[0]);
+        return 1;
+    }
+
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    ServerConfig config = {
+        .model_path = argv[2],
+        .vocab_path = argv[3],
+        .bpe_path = NULL,
+        .socket_path = NULL,
+        .port = DEFAULT_SERVE_PORT,
+        .workers = online > 0 ? (int)online : 1,
+        .queue_size = 1024,
+        .max_length = 256,
+    };
+    for (int i = 4; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--socket") == 0)
+            config.socket_path = argv[i + 1];
+        else if (strcmp(argv[i], "--port") == 0)
+            config.port = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--workers") == 0)
+            config.workers = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--queue") == 0)
+            config.queue_size = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--max-length") == 0)
+            config.max_length = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "--bpe") == 0)
+            config.bpe_path = argv[i + 1];
+        else
+        {
+            fprintf(stderr, "Error: Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    return server_run(&config) == 0 ? 0 : 1;
+}
+
+// rnn query <socket path | host:port> <request...>
+static int run_query(int argc, char **argv)
+{
+    if (argc < 4)
+    {
+        fprintf(stderr, "Usage: %s query <socket path | host:port> <request...>\n", argv[0]);
+        return 1;
+    }
+
+    char request[SERVER_MAX_MESSAGE];
+    size_t used = 0;
+    for (int i = 3; i < argc && used < sizeof(request); i++)
+        used += snprintf(request + used, sizeof(request) - used, i > 3 ? " %s" : "%s", argv[i]);
+    if (used >= sizeof(request))
+    {
+        fprintf(stderr, "Error: Request is too long\n");
+        return 1;
+    }
+
+    int fd = server_connect(argv[2]);
+    if (fd < 0)
+        return 1;
+    uint32_t length;
+    char *response = server_send_message(fd, request, (uint32_t)used) == 0 ? server_recv_message(fd, &length) : NULL;
+    close(fd);
+    if (!response)
+    {
+        fprintf(stderr, "Error: No response from %s\n", argv[2]);
+        return 1;
+    }
+    printf("%s\n", response);
+    int status = strncmp(response, "OK", 2) == 0 ? 0 : 1;
+    free(response);
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "tokenize") == 0)
+        return run_tokenize(argc, argv);
+    if (argc > 1 && strcmp(argv[1], "tokenize-bpe") == 0)
+        return run_tokenize_bpe(argc, argv);
+    if (argc > 1 && strcmp(argv[1], "generate") == 0)
+        return run_generate(argc, argv);
+    if (argc > 1 && strcmp(argv[1], "train") == 0)
+        return run_train(argc, argv);
+    if (argc > 1 && strcmp(argv[1], "prune") == 0)
+        return run_prune(argc, argv);
+    if (argc > 1 && strcmp(argv[1], "factorize") == 0)
+        return run_factorize(argc, argv);
+    if (argc > 1 && strcmp(argv[1], "evaluate") == 0)
+        return run_evaluate(argc, argv);
+    if (argc > 1 && strcmp(argv[1], "bptt") == 0)
+        return run_bptt(argc, argv);
+    if (argc > 1 && strcmp(argv[1], "update") == 0)
+        return run_update(argc, argv);
+    if (argc > 1 && strcmp(argv[1], "serve") == 0)
+        return run_serve(argc, argv);
+    if (argc > 1 && strcmp(argv[1], "query") == 0)
+        return run_query(argc, argv);
+
     // Initialize vocabulary
     Vocabulary *v = vocabulary_create(100);
 
@@ -19,90 +1314,113 @@ int main()
 
     int num_samples = sizeof(training_data) / sizeof(training_data[0]);
 
-    // Add words to the vocabulary
+    // Join the sentences into one corpus, one sentence per line
+    size_t text_length = 0;
     for (int i = 0; i < num_samples; i++)
+        text_length += strlen(training_data[i]) + 1;
+    char *text = (char *)malloc(text_length + 1);
+    if (text == NULL)
     {
-        char *sentence = strdup(training_data[i]);
-        char *word = strtok(sentence, " ");
-        while (word != NULL)
-        {
-            vocabulary_add_word(v, word);
-            word = strtok(NULL, " ");
-        }
-        free(sentence);
+        fprintf(stderr, "Memory allocation failed\n");
+        return 1;
+    }
+    text[0] = '\0';
+    for (int i = 0; i < num_samples; i++)
+    {
+        strcat(text, training_data[i]);
+        strcat(text, "\n");
     }
 
+    // Tokenize the corpus (adding words to the vocabulary) and write the token file
+    size_t num_tokens;
+    uint32_t *tokens = dataset_tokenize(v, text, &num_tokens);
+    free(text);
+    if (dataset_write(TRAINING_TOKENS_PATH, v, tokens, num_tokens) != 0)
+        return 1;
+    free(tokens);
+
+    Dataset *dataset = dataset_open(TRAINING_TOKENS_PATH);
+    if (dataset == NULL)
+        return 1;
+
     // Parameters
     int input_size = v->size;
     int hidden_size = 100;
     int output_size = v->size;
     double learning_rate = 0.01;
+    int batch_size = 16;
+    int prefetch = 4;
 
     RNN *rnn = rnn_init(input_size, hidden_size, output_size, learning_rate);
+    rnn_autotune(rnn, stdout);
 
-    // Prepare training data: input-target pairs
-    Matrix **input_vectors = (Matrix **)malloc(num_samples * sizeof(Matrix *));
-    Matrix **target_vectors = (Matrix **)malloc(num_samples * sizeof(Matrix *));
-
-    if (input_vectors == NULL || target_vectors == NULL)
-    {
-        fprintf(stderr, "Memory allocation failed\n");
+    // Stream shuffled (input, target) pairs from the token file
+    DatasetIterator *it = dataset_iterator_create(dataset, 1, batch_size, prefetch, 42);
+    if (it == NULL)
         return 1;
-    }
 
-    // Convert sentences to sequences of one-hot encoded vectors
-    for (int i = 0; i < num_samples; i++)
-    {
-        char *sentence = strdup(training_data[i]);
-        char *word = strtok(sentence, " ");
-        input_vectors[i] = create_one_hot_vector(v, word);
-
-        word = strtok(NULL, " ");
-        target_vectors[i] = create_one_hot_vector(v, word);
-
-        free(sentence);
-    }
+    Matrix *input_vector = matrix_zero(input_size, 1);
+    Matrix *target_vector = matrix_zero(output_size, 1);
 
     // Train the RNN
-    int epochs = 2000;
+    int epochs = 200;
     for (int epoch = 0; epoch < epochs; epoch++)
     {
+        matrix_memory_reset_peak();
         double epoch_loss = 0.0;
-        for (int i = 0; i < num_samples; i++)
+        int epoch_samples = 0;
+        int last_in_epoch = 0;
+        while (!last_in_epoch)
         {
-            Matrix *output = rnn_forward(rnn, input_vectors[i]);
-            rnn_backward(rnn, input_vectors[i], target_vectors[i]);
+            DatasetBatch *batch = dataset_iterator_next(it);
+            if (batch == NULL)
+                return 1;
+            for (int i = 0; i < batch->batch_size; i++)
+            {
+                set_one_hot(input_vector, batch->inputs[i]);
+                set_one_hot(target_vector, batch->targets[i]);
+
+                Matrix *output = rnn_forward(rnn, input_vector);
+                rnn_backward(rnn, input_vector, target_vector);
 
-            double loss = matrix_mean_square_error(output, target_vectors[i]);
-            epoch_loss += loss;
+                double loss = matrix_mean_square_error(output, target_vector);
+                epoch_loss += loss;
+                epoch_samples++;
 
-            matrix_free(output);
+                matrix_free(output);
+            }
+            last_in_epoch = batch->last_in_epoch;
+            dataset_iterator_release(it, batch);
         }
 
-        double avg_epoch_loss = epoch_loss / num_samples;
-        if (epoch % 1000 == 0) // Print loss every 1000 epochs
+        double avg_epoch_loss = epoch_loss / epoch_samples;
+        if (epoch % 50 == 0) // Print loss every 50 epochs
         {
             printf("Epoch %d, Average Loss: %f\n", epoch, avg_epoch_loss);
+            rnn_memory_report(rnn, stdout, "epoch");
         }
     }
 
+    // Save the model together with its vocabulary so inference can start without the corpus
+    rnn_save(rnn, MODEL_PATH);
+    vocabulary_save(v, VOCABULARY_PATH);
+
     // Generate text after training
     char *input_text = "Rain";
+    matrix_memory_reset_peak();
     char *next_word_predictions = rnn_generate_text(v, rnn, input_text, 5);
     printf("Input text: %s\n", input_text);
     printf("Next word predictions: %s\n", next_word_predictions);
-    
+    matrix_memory_report(stdout, "generation");
+
     // Clean up
     free(next_word_predictions);
-    for (int i = 0; i < num_samples; i++)
-    {
-        matrix_free(input_vectors[i]);
-        matrix_free(target_vectors[i]);
-    }
-    free(input_vectors);
-    free(target_vectors);
+    matrix_free(input_vector);
+    matrix_free(target_vector);
+    dataset_iterator_free(it);
+    dataset_close(dataset);
     rnn_free(rnn);
     vocabulary_free(v);
 
-    return 0;
-}
\ No newline at end of file
+    return matrix_memory_report_leaks(stderr) == 0 ? 0 : 1;
+}
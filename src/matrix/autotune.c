@@ -0,0 +1,327 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "autotune.h"
+
+#define CACHE_HEADER "# rnn kernel tuning cache v1\n"
+#define MAX_CPU_KEY 256
+#define MAX_CACHE_LINE 512
+#define BENCH_MIN_SECONDS 0.002
+#define BENCH_TRIALS 3
+
+// One line of the cache file: <cpu key>\t<rows> <inner> <cols>\t<block> <unroll> <threads>
+typedef struct
+{
+    char cpu[MAX_CPU_KEY];
+    MatrixShape shape;
+    MatrixKernel kernel;
+} CacheEntry;
+
+typedef struct
+{
+    CacheEntry *entries;
+    int count;
+    int capacity;
+} TuningCache;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+const char *autotune_cache_path(void)
+{
+    static char path[1024];
+    const char *configured = getenv("RNN_TUNING_CACHE");
+    if (configured)
+        return strcmp(configured, "off") == 0 || configured[0] == '\0' ? NULL : configured;
+
+    const char *home = getenv("HOME");
+    if (!home)
+        return "rnn-kernels.txt";
+    snprintf(path, sizeof(path), "%s/.cache/rnn-kernels.txt", home);
+    return path;
+}
+
+void autotune_cpu_key(char *buffer, size_t size)
+{
+    char model[MAX_CPU_KEY] = "unknown";
+    FILE *cpuinfo = fopen("/proc/cpuinfo", "r");
+    if (cpuinfo)
+    {
+        char line[MAX_CACHE_LINE];
+        while (fgets(line, sizeof(line), cpuinfo))
+        {
+            char *value = strchr(line, ':');
+            if (strncmp(line, "model name", 10) != 0 || !value)
+                continue;
+            value++;
+            while (*value == ' ')
+                value++;
+            value[strcspn(value, "\t\n")] = '\0';
+            snprintf(model, sizeof(model), "%s", value);
+            break;
+        }
+        fclose(cpuinfo);
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    snprintf(buffer, size, "%s x%ld", model, cpus > 0 ? cpus : 1);
+}
+
+static void cache_add(TuningCache *cache, const CacheEntry *entry)
+{
+    if (cache->count == cache->capacity)
+    {
+        cache->capacity = cache->capacity ? cache->capacity * 2 : 16;
+        cache->entries = (CacheEntry *)realloc(cache->entries, cache->capacity * sizeof(CacheEntry));
+        if (!cache->entries)
+        {
+            fprintf(stderr, "Error: Unable to allocate memory for the tuning cache\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    cache->entries[cache->count++] = *entry;
+}
+
+static const CacheEntry *cache_find(const TuningCache *cache, const char *cpu, MatrixShape shape)
+{
+    for (int i = 0; i < cache->count; i++)
+    {
+        const CacheEntry *e = &cache->entries[i];
+        if (e->shape.rows == shape.rows && e->shape.inner == shape.inner && e->shape.cols == shape.cols &&
+            strcmp(e->cpu, cpu) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+// A missing or unreadable cache is simply empty
+static void cache_load(TuningCache *cache, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return;
+    char line[MAX_CACHE_LINE];
+    while (fgets(line, sizeof(line), file))
+    {
+        char *shape = strchr(line, '\t');
+        char *kernel = shape ? strchr(shape + 1, '\t') : NULL;
+        if (line[0] == '#' || !kernel)
+            continue;
+        *shape++ = '\0';
+        *kernel++ = '\0';
+
+        CacheEntry entry;
+        snprintf(entry.cpu, sizeof(entry.cpu), "%.*s", (int)sizeof(entry.cpu) - 1, line);
+        if (sscanf(shape, "%d %d %d", &entry.shape.rows, &entry.shape.inner, &entry.shape.cols) != 3 ||
+            sscanf(kernel, "%d %d %d", &entry.kernel.block, &entry.kernel.unroll, &entry.kernel.threads) != 3)
+            continue;
+        cache_add(cache, &entry);
+    }
+    fclose(file);
+}
+
+static int cache_write(const TuningCache *cache, const char *path)
+{
+    // Write to a temporary file and rename, so readers never see a partial cache
+    char temp[1100];
+    snprintf(temp, sizeof(temp), "%s.%ld.tmp", path, (long)getpid());
+    FILE *file = fopen(temp, "w");
+    if (!file)
+        return -1;
+    fputs(CACHE_HEADER, file);
+    for (int i = 0; i < cache->count; i++)
+    {
+        const CacheEntry *e = &cache->entries[i];
+        fprintf(file, "%s\t%d %d %d\t%d %d %d\n", e->cpu, e->shape.rows, e->shape.inner, e->shape.cols,
+                e->kernel.block, e->kernel.unroll, e->kernel.threads);
+    }
+    if (fclose(file) != 0 || rename(temp, path) != 0)
+    {
+        remove(temp);
+        return -1;
+    }
+    return 0;
+}
+
+// Add newly tuned entries to the cache file. Other processes may have tuned
+// other shapes since it was loaded, so the file is read again and merged
+// while holding a lock beside it.
+static int cache_save(const TuningCache *tuned, const char *path)
+{
+    char lock_path[1100];
+    snprintf(lock_path, sizeof(lock_path), "%s", path);
+    char *slash = strrchr(lock_path, '/');
+    if (slash && slash != lock_path)
+    {
+        *slash = '\0';
+        mkdir(lock_path, 0755); // e.g. a fresh ~/.cache
+    }
+    snprintf(lock_path, sizeof(lock_path), "%s.lock", path);
+    int lock = open(lock_path, O_RDWR | O_CREAT, 0644);
+    if (lock < 0 || flock(lock, LOCK_EX) != 0)
+    {
+        fprintf(stderr, "Warning: Unable to lock kernel tuning cache %s\n", path);
+        if (lock >= 0)
+            close(lock);
+        return -1;
+    }
+
+    TuningCache merged = {NULL, 0, 0};
+    cache_load(&merged, path);
+    for (int i = 0; i < tuned->count; i++)
+    {
+        const CacheEntry *e = &tuned->entries[i];
+        if (!cache_find(&merged, e->cpu, e->shape))
+            cache_add(&merged, e);
+    }
+    int status = cache_write(&merged, path);
+    if (status != 0)
+        fprintf(stderr, "Warning: Unable to write kernel tuning cache %s\n", path);
+
+    free(merged.entries);
+    close(lock); // Releases the lock
+    return status;
+}
+
+// Best time of a few trials, each repeating the product for at least
+// BENCH_MIN_SECONDS. b is packed into x for a batch shape, with results in y.
+static double bench_kernel(Matrix *a, Matrix *b, const double *x, double *y, MatrixKernel kernel)
+{
+    double best = 0.0;
+    for (int trial = 0; trial < BENCH_TRIALS; trial++)
+    {
+        int runs = 0;
+        double start = now_seconds(), elapsed;
+        do
+        {
+            if (x)
+                matrix_gemv_batch_kernel(a, x, b->cols, y, kernel);
+            else
+                matrix_free(matrix_dot_kernel(a, b, kernel));
+            runs++;
+            elapsed = now_seconds() - start;
+        } while (elapsed < BENCH_MIN_SECONDS);
+        double per_run = elapsed / runs;
+        if (trial == 0 || per_run < best)
+            best = per_run;
+    }
+    return best;
+}
+
+// Search block size and unroll on one thread, then the thread count for the
+// winner. A shape with MATRIX_BATCH_GROUP columns is timed as matrix_gemv_batch,
+// which has no unroll to search.
+static MatrixKernel tune_shape(MatrixShape shape, double *speedup)
+{
+    const int blocks[] = {0, 256, 1024, 4096};
+    const int unrolls[] = {1, 2, 4, 8};
+    int num_unrolls = shape.cols == MATRIX_BATCH_GROUP ? 1 : sizeof(unrolls) / sizeof(unrolls[0]);
+    Matrix *a = matrix_create(shape.rows, shape.inner);
+    Matrix *b = matrix_create(shape.inner, shape.cols);
+    matrix_randomize(a, -1.0, 1.0);
+    matrix_randomize(b, -1.0, 1.0);
+
+    double *x = NULL, *y = NULL;
+    if (shape.cols == MATRIX_BATCH_GROUP)
+    {
+        x = (double *)malloc(((size_t)shape.inner + shape.rows) * shape.cols * sizeof(double));
+        if (!x)
+        {
+            fprintf(stderr, "Error: Unable to allocate memory for kernel tuning\n");
+            exit(EXIT_FAILURE);
+        }
+        y = x + (size_t)shape.inner * shape.cols;
+        for (int c = 0; c < shape.cols; c++)
+        {
+            for (int k = 0; k < shape.inner; k++)
+                x[(size_t)c * shape.inner + k] = b->entries[k][c];
+        }
+    }
+
+    MatrixKernel best = {0, 1, 1};
+    double baseline = bench_kernel(a, b, x, y, best);
+    double best_time = baseline;
+    for (size_t i = 0; i < sizeof(blocks) / sizeof(blocks[0]); i++)
+    {
+        if (blocks[i] >= shape.inner)
+            continue;
+        for (int j = 0; j < num_unrolls; j++)
+        {
+            MatrixKernel candidate = {blocks[i], unrolls[j], 1};
+            if (blocks[i] == 0 && unrolls[j] == 1)
+                continue;
+            double time = bench_kernel(a, b, x, y, candidate);
+            if (time < best_time)
+            {
+                best_time = time;
+                best = candidate;
+            }
+        }
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int threads = 2; threads <= cpus && threads <= shape.rows; threads *= 2)
+    {
+        MatrixKernel candidate = {best.block, best.unroll, threads};
+        double time = bench_kernel(a, b, x, y, candidate);
+        if (time < best_time)
+        {
+            best_time = time;
+            best = candidate;
+        }
+    }
+
+    free(x);
+    matrix_free(a);
+    matrix_free(b);
+    *speedup = baseline / best_time;
+    return best;
+}
+
+int autotune_kernels(const MatrixShape *shapes, int num_shapes, const char *cache_path, FILE *log)
+{
+    char cpu[MAX_CPU_KEY];
+    autotune_cpu_key(cpu, sizeof(cpu));
+    TuningCache cache = {NULL, 0, 0};
+    TuningCache fresh = {NULL, 0, 0}; // Entries tuned by this run
+    cache_load(&cache, cache_path);
+
+    int tuned = 0;
+    for (int i = 0; i < num_shapes; i++)
+    {
+        const CacheEntry *cached = cache_find(&cache, cpu, shapes[i]);
+        if (cached)
+        {
+            matrix_kernel_set(shapes[i].rows, shapes[i].inner, shapes[i].cols, cached->kernel);
+            continue;
+        }
+
+        double speedup;
+        CacheEntry entry;
+        snprintf(entry.cpu, sizeof(entry.cpu), "%s", cpu);
+        entry.shape = shapes[i];
+        entry.kernel = tune_shape(shapes[i], &speedup);
+        cache_add(&cache, &entry);
+        cache_add(&fresh, &entry);
+        matrix_kernel_set(shapes[i].rows, shapes[i].inner, shapes[i].cols, entry.kernel);
+        tuned++;
+        if (log)
+            fprintf(log, "Tuned %dx%dx%d: block %d, unroll %d, threads %d (%.2fx)\n", shapes[i].rows,
+                    shapes[i].inner, shapes[i].cols, entry.kernel.block, entry.kernel.unroll, entry.kernel.threads,
+                    speedup);
+    }
+
+    int status = tuned > 0 ? cache_save(&fresh, cache_path) : 0;
+    free(cache.entries);
+    free(fresh.entries);
+    return status < 0 ? -1 : tuned;
+}
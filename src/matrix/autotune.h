@@ -0,0 +1,18 @@
+#pragma once
+#include <stdio.h>
+#include <stddef.h>
+#include "matrix.h"
+
+// Cache file for tuned kernels: $RNN_TUNING_CACHE if set ("off" disables
+// tuning, returning NULL), else ~/.cache/rnn-kernels.txt
+const char *autotune_cache_path(void);
+
+// CPU model name and online CPU count, the host part of a cache key
+void autotune_cpu_key(char *buffer, size_t size);
+
+// Register the best kernel for every shape with matrix_kernel_set. Shapes
+// already in the cache for this CPU are reused; the others are benchmarked
+// and appended to the cache. Progress goes to log unless it is NULL.
+// Returns the number of shapes benchmarked, or -1 if the cache could not be
+// written.
+int autotune_kernels(const MatrixShape *shapes, int num_shapes, const char *cache_path, FILE *log);
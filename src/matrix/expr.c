@@ -0,0 +1,364 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define EXPR_IMPLEMENTATION
+#include "expr.h"
+
+void expr_graph_init(ExprGraph *g)
+{
+    g->count = 0;
+}
+
+static Expr *expr_node(ExprGraph *g, ExprOp op, int rows, int cols)
+{
+    if (g->count == EXPR_MAX_NODES)
+    {
+        fprintf(stderr, "Error: Expression has more than %d nodes\n", EXPR_MAX_NODES);
+        exit(EXIT_FAILURE);
+    }
+    Expr *e = &g->nodes[g->count++];
+    memset(e, 0, sizeof(Expr));
+    e->op = op;
+    e->rows = rows;
+    e->cols = cols;
+    return e;
+}
+
+static void check_same_shape(const char *name, Expr *a, Expr *b)
+{
+    if (a->rows != b->rows || a->cols != b->cols)
+    {
+        printf("(%s) Dimensions mismatch: %dx%d %dx%d\n", name, a->rows, a->cols, b->rows, b->cols);
+        exit(EXIT_FAILURE);
+    }
+}
+
+Expr *expr_matrix(ExprGraph *g, Matrix *m)
+{
+    Expr *e = expr_node(g, EXPR_MATRIX, m->rows, m->cols);
+    e->matrix = m;
+    return e;
+}
+
+Expr *expr_transpose(ExprGraph *g, Expr *a)
+{
+    if (a->op == EXPR_TRANSPOSE)
+        return a->left;
+    Expr *e = expr_node(g, EXPR_TRANSPOSE, a->cols, a->rows);
+    e->left = a;
+    return e;
+}
+
+Expr *expr_dot(ExprGraph *g, Expr *a, Expr *b)
+{
+    if (a->cols != b->rows)
+    {
+        printf("(expr_dot) Dimensions mismatch dot: %dx%d %dx%d\n", a->rows, a->cols, b->rows, b->cols);
+        exit(EXIT_FAILURE);
+    }
+    Expr *e = expr_node(g, EXPR_DOT, a->rows, b->cols);
+    e->left = a;
+    e->right = b;
+    return e;
+}
+
+Expr *expr_add(ExprGraph *g, Expr *a, Expr *b)
+{
+    check_same_shape("expr_add", a, b);
+    Expr *e = expr_node(g, EXPR_ADD, a->rows, a->cols);
+    e->left = a;
+    e->right = b;
+    return e;
+}
+
+Expr *expr_subtract(ExprGraph *g, Expr *a, Expr *b)
+{
+    check_same_shape("expr_subtract", a, b);
+    Expr *e = expr_node(g, EXPR_SUBTRACT, a->rows, a->cols);
+    e->left = a;
+    e->right = b;
+    return e;
+}
+
+Expr *expr_scale(ExprGraph *g, double n, Expr *a)
+{
+    Expr *e = expr_node(g, EXPR_SCALE, a->rows, a->cols);
+    e->left = a;
+    e->scale = n;
+    return e;
+}
+
+Expr *expr_apply(ExprGraph *g, double (*func)(double), Expr *a)
+{
+    Expr *e = expr_node(g, EXPR_APPLY, a->rows, a->cols);
+    e->left = a;
+    e->func = func;
+    return e;
+}
+
+// A product with an inner dimension of one: a column times a row
+static int is_outer(const Expr *e)
+{
+    return e->op == EXPR_DOT && e->left->cols == 1;
+}
+
+static const double *eval_row(Expr *e, int i, double *out);
+
+// Row i of an add/subtract operand as coefficient * row. A scale or an outer
+// product folds into the coefficient instead of being computed into a row.
+// Nested scales are not folded, since (a * b) * x may round differently from a * (b * x).
+static const double *operand_row(Expr *e, int i, double *coef)
+{
+    *coef = 1.0;
+    if (e->matrix)
+        return e->matrix->entries[i];
+    if (is_outer(e))
+    {
+        *coef = eval_row(e->left, i, e->left->row)[0];
+        return e->outer_row;
+    }
+    if (e->op == EXPR_SCALE && e->left->op != EXPR_SCALE && !is_outer(e->left))
+    {
+        *coef = e->scale;
+        return eval_row(e->left, i, e->left->row);
+    }
+    return eval_row(e, i, e->row);
+}
+
+// Row i of e: a row of a stored matrix when there is one, otherwise computed into out
+static const double *eval_row(Expr *e, int i, double *out)
+{
+    if (e->matrix)
+        return e->matrix->entries[i];
+
+    const double *a, *b;
+    double ca, cb;
+    switch (e->op)
+    {
+    case EXPR_TRANSPOSE:
+        for (int j = 0; j < e->cols; j++)
+            out[j] = e->left->matrix->entries[j][i];
+        break;
+    case EXPR_DOT: // Outer product; everything else was computed ahead
+        ca = eval_row(e->left, i, e->left->row)[0];
+        for (int j = 0; j < e->cols; j++)
+            out[j] = ca * e->outer_row[j];
+        break;
+    case EXPR_SCALE:
+        a = eval_row(e->left, i, e->left->row);
+        for (int j = 0; j < e->cols; j++)
+            out[j] = e->scale * a[j];
+        break;
+    case EXPR_APPLY:
+        a = eval_row(e->left, i, e->left->row);
+        for (int j = 0; j < e->cols; j++)
+            out[j] = e->func(a[j]);
+        break;
+    case EXPR_ADD:
+    case EXPR_SUBTRACT:
+        a = operand_row(e->left, i, &ca);
+        b = operand_row(e->right, i, &cb);
+        if (e->op == EXPR_SUBTRACT)
+            cb = -cb;
+        if (ca == 1.0)
+        {
+            for (int j = 0; j < e->cols; j++)
+                out[j] = a[j] + cb * b[j];
+        }
+        else
+        {
+            for (int j = 0; j < e->cols; j++)
+                out[j] = ca * a[j] + cb * b[j];
+        }
+        break;
+    default:
+        break;
+    }
+    return out;
+}
+
+static void prepare(Expr *e, const Matrix *dst);
+
+// Compute e into a temporary, for operands that must be read out of row order
+static void materialize(Expr *e)
+{
+    Matrix *m = matrix_create(e->rows, e->cols);
+    for (int i = 0; i < e->rows; i++)
+    {
+        const double *row = eval_row(e, i, m->entries[i]);
+        if (row != m->entries[i])
+            memcpy(m->entries[i], row, e->cols * sizeof(double));
+    }
+    e->matrix = m;
+    e->owned = 1;
+}
+
+static Matrix *stored_operand(Expr *e, const Matrix *dst)
+{
+    prepare(e, dst);
+    if (!e->matrix)
+        materialize(e);
+    return e->matrix;
+}
+
+// a * b with transposes taken as flags; every output sums its terms in the
+// same order as matrix_dot on transposed copies
+static void compute_product(Expr *e, const Matrix *dst)
+{
+    Expr *left = e->left, *right = e->right;
+    int ta = left->op == EXPR_TRANSPOSE && !left->matrix;
+    int tb = right->op == EXPR_TRANSPOSE && !right->matrix;
+    Matrix *a = stored_operand(ta ? left->left : left, dst);
+    Matrix *b = stored_operand(tb ? right->left : right, dst);
+    int inner = left->cols;
+
+    if (!ta && !tb)
+    {
+        e->matrix = matrix_dot(a, b); // Uses the tuned kernels
+        e->owned = 1;
+        return;
+    }
+
+    Matrix *m = matrix_create(e->rows, e->cols);
+    if (ta && !tb)
+    {
+        // a^T * b: stream the rows of a once, accumulating all outputs
+        double *acc = (double *)calloc((size_t)e->rows * e->cols, sizeof(double));
+        if (!acc)
+        {
+            fprintf(stderr, "Error: Unable to allocate memory for a product\n");
+            exit(EXIT_FAILURE);
+        }
+        for (int k = 0; k < inner; k++)
+        {
+            const double *a_row = a->entries[k];
+            for (int q = 0; q < e->cols; q++)
+            {
+                double y = b->entries[k][q];
+                double *c = acc + (size_t)q * e->rows;
+                for (int p = 0; p < e->rows; p++)
+                    c[p] += a_row[p] * y;
+            }
+        }
+        for (int p = 0; p < e->rows; p++)
+        {
+            for (int q = 0; q < e->cols; q++)
+                m->entries[p][q] = acc[(size_t)q * e->rows + p];
+        }
+        free(acc);
+    }
+    else
+    {
+        // a * b^T reads both operands along rows; a^T * b^T strides through a
+        for (int p = 0; p < e->rows; p++)
+        {
+            for (int q = 0; q < e->cols; q++)
+            {
+                const double *b_row = b->entries[q];
+                double sum = 0;
+                for (int k = 0; k < inner; k++)
+                    sum += (ta ? a->entries[k][p] : a->entries[p][k]) * b_row[k];
+                m->entries[p][q] = sum;
+            }
+        }
+    }
+    e->matrix = m;
+    e->owned = 1;
+}
+
+static double *scratch_row(int cols)
+{
+    double *row = (double *)malloc((cols > 0 ? cols : 1) * sizeof(double));
+    if (!row)
+    {
+        fprintf(stderr, "Error: Unable to allocate memory for an expression\n");
+        exit(EXIT_FAILURE);
+    }
+    return row;
+}
+
+// Compute ahead whatever the row pass cannot stream: products with an inner
+// dimension, transposed reads of dst, and the row of each outer product
+static void prepare(Expr *e, const Matrix *dst)
+{
+    if (e->matrix || e->row)
+        return; // A leaf, or a node shared by two parents
+    switch (e->op)
+    {
+    case EXPR_TRANSPOSE:
+        stored_operand(e->left, dst);
+        e->row = scratch_row(e->cols);
+        if (e->left->matrix == dst)
+            materialize(e); // Would read columns of dst while its rows are written
+        break;
+    case EXPR_DOT:
+        if (!is_outer(e))
+        {
+            compute_product(e, dst);
+            break;
+        }
+        prepare(e->left, dst);
+        prepare(e->right, dst);
+        e->row = scratch_row(e->cols);
+        e->outer_row = eval_row(e->right, 0, e->right->row);
+        break;
+    case EXPR_ADD:
+    case EXPR_SUBTRACT:
+        prepare(e->right, dst);
+        // fall through
+    case EXPR_SCALE:
+    case EXPR_APPLY:
+        prepare(e->left, dst);
+        e->row = scratch_row(e->cols);
+        break;
+    default:
+        break;
+    }
+}
+
+static void release(Expr *e)
+{
+    if (!e)
+        return;
+    if (e->op != EXPR_MATRIX)
+    {
+        release(e->left);
+        release(e->right);
+    }
+    if (e->owned)
+    {
+        matrix_free(e->matrix);
+        e->matrix = NULL;
+        e->owned = 0;
+    }
+    free(e->row);
+    e->row = NULL;
+    e->outer_row = NULL;
+}
+
+void expr_assign(Matrix *dst, Expr *e)
+{
+    if (dst->rows != e->rows || dst->cols != e->cols)
+    {
+        printf("(expr_assign) Dimensions mismatch: %dx%d %dx%d\n", dst->rows, dst->cols, e->rows, e->cols);
+        exit(EXIT_FAILURE);
+    }
+    prepare(e, dst);
+    for (int i = 0; i < dst->rows; i++)
+    {
+        // Every operand still to be read at row i is read at row i only, so
+        // writing the result straight into dst is safe even when dst is one
+        const double *row = eval_row(e, i, dst->entries[i]);
+        if (row != dst->entries[i])
+            memcpy(dst->entries[i], row, dst->cols * sizeof(double));
+    }
+    release(e);
+}
+
+Matrix *expr_eval(Expr *e)
+{
+    // Allocated first, so allocation tracking attributes it to the caller
+    Matrix *m = (matrix_create)(e->rows, e->cols);
+    expr_assign(m, e);
+    return m;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include "matrix.h"
+
+// Lazy matrix expressions. Building an expression only records the operations;
+// expr_eval and expr_assign compute the whole tree at once and fuse it:
+// - a transpose is read in place, or passed to the product as a flag; it is never copied
+// - element-wise operations (add, subtract, scale, apply) run as one pass per row
+// - a scaled operand folds into its add or subtract, so w - lr * g is an axpy
+// - an outer product a * b^T is never formed; element (i, j) is a[i] * b[j]
+// Only products with an inner dimension above one are computed into temporaries.
+// Results match the eager matrix_* functions exactly.
+
+typedef enum
+{
+    EXPR_MATRIX,
+    EXPR_TRANSPOSE,
+    EXPR_DOT,
+    EXPR_ADD,
+    EXPR_SUBTRACT,
+    EXPR_SCALE,
+    EXPR_APPLY
+} ExprOp;
+
+typedef struct Expr
+{
+    ExprOp op;
+    int rows;
+    int cols;
+    struct Expr *left;
+    struct Expr *right;      // Second operand of a binary operation
+    double scale;            // EXPR_SCALE factor
+    double (*func)(double);  // EXPR_APPLY function
+    Matrix *matrix;          // EXPR_MATRIX operand, or a value computed ahead of the row pass
+    int owned;               // matrix is a temporary of the current evaluation
+    double *row;             // Scratch for one row of this node during evaluation
+    const double *outer_row; // Right operand of an outer product, read once per evaluation
+} Expr;
+
+#define EXPR_MAX_NODES 16
+
+// Storage for the nodes of one expression, usually on the caller's stack
+typedef struct
+{
+    Expr nodes[EXPR_MAX_NODES];
+    int count;
+} ExprGraph;
+
+void expr_graph_init(ExprGraph *g);
+
+// Building
+Expr *expr_matrix(ExprGraph *g, Matrix *m);
+Expr *expr_transpose(ExprGraph *g, Expr *a);
+Expr *expr_dot(ExprGraph *g, Expr *a, Expr *b);
+Expr *expr_add(ExprGraph *g, Expr *a, Expr *b);
+Expr *expr_subtract(ExprGraph *g, Expr *a, Expr *b);
+Expr *expr_scale(ExprGraph *g, double n, Expr *a);
+Expr *expr_apply(ExprGraph *g, double (*func)(double), Expr *a);
+
+// Evaluation
+Matrix *expr_eval(Expr *e);             // New matrix holding the value of e
+void expr_assign(Matrix *dst, Expr *e); // dst = e in place; e may read dst, e.g. w = w - lr * g
+
+#if defined(MATRIX_TRACK_ALLOCATIONS) && !defined(EXPR_IMPLEMENTATION)
+#define expr_eval(e) MATRIX_TRACKED(expr_eval(e))
+#endif
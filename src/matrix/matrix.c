@@ -2,10 +2,227 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <pthread.h>
+#define MATRIX_IMPLEMENTATION
 #include "matrix.h"
 
 #define MAXCHAR 100
+#define MAX_TRACKED_SITES 1024
+#define MAX_KERNEL_SHAPES 64
+#define MAX_KERNEL_THREADS 64
+
+static size_t live_bytes = 0;
+static size_t peak_bytes = 0;
+static long live_count = 0;
+static size_t class_live_bytes[MATRIX_MEMORY_CLASSES];
+static size_t class_peak_bytes[MATRIX_MEMORY_CLASSES];
+static __thread MatrixMemoryClass allocation_class = MATRIX_MEMORY_WORKSPACE;
+
+#ifdef MATRIX_TRACK_ALLOCATIONS
+typedef struct
+{
+    const char *file;
+    int line;
+    long live_count;
+    size_t live_bytes;
+    size_t peak_bytes;
+    long total_count; // Matrices allocated here since startup
+} MatrixSite;
+
+static MatrixSite sites[MAX_TRACKED_SITES];
+static int num_sites = 0;
+static pthread_mutex_t sites_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread const char *pending_file = NULL;
+static __thread int pending_line = 0;
+
+// Remember the caller of the next allocating matrix function on this thread
+void matrix_track_site(const char *file, int line)
+{
+    pending_file = file;
+    pending_line = line;
+}
+
+static int find_site(const char *file, int line)
+{
+    for (int i = 0; i < num_sites; i++)
+    {
+        if (sites[i].line == line && sites[i].file == file)
+            return i;
+    }
+    if (num_sites == MAX_TRACKED_SITES)
+        return 0; // Out of slots, lump the rest into the first site
+    sites[num_sites].file = file;
+    sites[num_sites].line = line;
+    return num_sites++;
+}
+#endif
+
+size_t matrix_memory_bytes(const Matrix *m)
+{
+    return sizeof(Matrix) + (size_t)m->row_capacity * sizeof(double *) + (size_t)m->rows * m->col_capacity * sizeof(double);
+}
+
+// Add delta bytes to a live counter and raise its high-water mark
+static void memory_add(size_t *live_counter, size_t *peak_counter, size_t delta)
+{
+    size_t live = __atomic_add_fetch(live_counter, delta, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(peak_counter, __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n(peak_counter, &peak, live, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static void memory_account(Matrix *m, int sign)
+{
+    size_t bytes = matrix_memory_bytes(m);
+    if (sign > 0)
+    {
+        __atomic_add_fetch(&live_count, 1, __ATOMIC_RELAXED);
+        memory_add(&live_bytes, &peak_bytes, bytes);
+        memory_add(&class_live_bytes[m->memory_class], &class_peak_bytes[m->memory_class], bytes);
+    }
+    else
+    {
+        __atomic_sub_fetch(&live_count, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&live_bytes, bytes, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&class_live_bytes[m->memory_class], bytes, __ATOMIC_RELAXED);
+    }
+
+#ifdef MATRIX_TRACK_ALLOCATIONS
+    pthread_mutex_lock(&sites_lock);
+    if (sign > 0)
+    {
+        m->alloc_site = find_site(pending_file ? pending_file : "(untracked)", pending_file ? pending_line : 0);
+        pending_file = NULL;
+        MatrixSite *site = &sites[m->alloc_site];
+        site->live_count++;
+        site->total_count++;
+        site->live_bytes += bytes;
+        if (site->live_bytes > site->peak_bytes)
+            site->peak_bytes = site->live_bytes;
+    }
+    else
+    {
+        MatrixSite *site = &sites[m->alloc_site];
+        site->live_count--;
+        site->live_bytes -= bytes;
+    }
+    pthread_mutex_unlock(&sites_lock);
+#endif
+}
+
+// Move a resized matrix from old_bytes to its current size, keeping its allocation site
+static void memory_reaccount(Matrix *m, size_t old_bytes)
+{
+    size_t bytes = matrix_memory_bytes(m);
+    memory_add(&live_bytes, &peak_bytes, bytes - old_bytes);
+    memory_add(&class_live_bytes[m->memory_class], &class_peak_bytes[m->memory_class], bytes - old_bytes);
+
+#ifdef MATRIX_TRACK_ALLOCATIONS
+    pthread_mutex_lock(&sites_lock);
+    MatrixSite *site = &sites[m->alloc_site];
+    site->live_bytes += bytes - old_bytes;
+    if (site->live_bytes > site->peak_bytes)
+        site->peak_bytes = site->live_bytes;
+    pthread_mutex_unlock(&sites_lock);
+#endif
+}
+
+size_t matrix_memory_live_bytes(void)
+{
+    return __atomic_load_n(&live_bytes, __ATOMIC_RELAXED);
+}
+
+size_t matrix_memory_peak_bytes(void)
+{
+    return __atomic_load_n(&peak_bytes, __ATOMIC_RELAXED);
+}
+
+MatrixMemoryClass matrix_memory_set_class(MatrixMemoryClass memory_class)
+{
+    MatrixMemoryClass previous = allocation_class;
+    allocation_class = memory_class;
+    return previous;
+}
+
+void matrix_memory_classify(Matrix *m, MatrixMemoryClass memory_class)
+{
+    if (m->memory_class == memory_class)
+        return;
+    size_t bytes = matrix_memory_bytes(m);
+    __atomic_sub_fetch(&class_live_bytes[m->memory_class], bytes, __ATOMIC_RELAXED);
+    m->memory_class = memory_class;
+    memory_add(&class_live_bytes[memory_class], &class_peak_bytes[memory_class], bytes);
+}
+
+size_t matrix_memory_class_live_bytes(MatrixMemoryClass memory_class)
+{
+    return __atomic_load_n(&class_live_bytes[memory_class], __ATOMIC_RELAXED);
+}
+
+size_t matrix_memory_class_peak_bytes(MatrixMemoryClass memory_class)
+{
+    return __atomic_load_n(&class_peak_bytes[memory_class], __ATOMIC_RELAXED);
+}
+
+long matrix_memory_live_count(void)
+{
+    return __atomic_load_n(&live_count, __ATOMIC_RELAXED);
+}
+
+// Start a new high-water mark window (e.g. per epoch or per generation)
+void matrix_memory_reset_peak(void)
+{
+    __atomic_store_n(&peak_bytes, matrix_memory_live_bytes(), __ATOMIC_RELAXED);
+    for (int c = 0; c < MATRIX_MEMORY_CLASSES; c++)
+        __atomic_store_n(&class_peak_bytes[c], matrix_memory_class_live_bytes(c), __ATOMIC_RELAXED);
+#ifdef MATRIX_TRACK_ALLOCATIONS
+    pthread_mutex_lock(&sites_lock);
+    for (int i = 0; i < num_sites; i++)
+        sites[i].peak_bytes = sites[i].live_bytes;
+    pthread_mutex_unlock(&sites_lock);
+#endif
+}
+
+void matrix_memory_report(FILE *out, const char *label)
+{
+    fprintf(out, "[memory] %s: %ld live matrices, %.1f KiB live, %.1f KiB peak\n", label,
+            matrix_memory_live_count(), matrix_memory_live_bytes() / 1024.0, matrix_memory_peak_bytes() / 1024.0);
+#ifdef MATRIX_TRACK_ALLOCATIONS
+    pthread_mutex_lock(&sites_lock);
+    for (int i = 0; i < num_sites; i++)
+    {
+        if (sites[i].peak_bytes == 0)
+            continue;
+        fprintf(out, "[memory]   %s:%d: %ld live, %.1f KiB live, %.1f KiB peak, %ld allocated\n",
+                sites[i].file, sites[i].line, sites[i].live_count, sites[i].live_bytes / 1024.0,
+                sites[i].peak_bytes / 1024.0, sites[i].total_count);
+    }
+    pthread_mutex_unlock(&sites_lock);
+#endif
+}
+
+// Report matrices that are still alive; call at shutdown after cleanup
+long matrix_memory_report_leaks(FILE *out)
+{
+    long leaked = matrix_memory_live_count();
+    if (leaked == 0)
+        return 0;
+
+    fprintf(out, "[memory] %ld matrices (%.1f KiB) leaked\n", leaked, matrix_memory_live_bytes() / 1024.0);
+#ifdef MATRIX_TRACK_ALLOCATIONS
+    pthread_mutex_lock(&sites_lock);
+    for (int i = 0; i < num_sites; i++)
+    {
+        if (sites[i].live_count > 0)
+            fprintf(out, "[memory]   leaked %ld from %s:%d (%.1f KiB)\n", sites[i].live_count,
+                    sites[i].file, sites[i].line, sites[i].live_bytes / 1024.0);
+    }
+    pthread_mutex_unlock(&sites_lock);
+#endif
+    return leaked;
+}
 
 Matrix* matrix_create(int rows, int cols) {
     // Allocate memory for the matrix structure
@@ -14,6 +231,9 @@ Matrix* matrix_create(int rows, int cols) {
 
     matrix->rows = rows;
     matrix->cols = cols;
+    matrix->row_capacity = rows;
+    matrix->col_capacity = cols;
+    matrix->memory_class = allocation_class;
 
     // Allocate memory for the matrix entries (array of row pointers)
     matrix->entries = malloc(rows * sizeof(double*));
@@ -36,12 +256,14 @@ Matrix* matrix_create(int rows, int cols) {
         }
     }
 
+    memory_account(matrix, 1);
     return matrix;  // Return the created matrix
 }
 
 // Function to free the matrix memory
 void matrix_free(Matrix* matrix) {
     if (matrix) {
+        memory_account(matrix, -1);
         // Free each row
         for (int i = 0; i < matrix->rows; i++) {
             free(matrix->entries[i]);
@@ -53,6 +275,60 @@ void matrix_free(Matrix* matrix) {
     }
 }
 
+// Grow or shrink a matrix without moving existing entries to a new matrix.
+// Capacity at least doubles when exceeded, so repeated growth by a few rows
+// or columns is amortized O(1) per entry.
+void matrix_resize(Matrix *m, int rows, int cols)
+{
+    size_t old_bytes = matrix_memory_bytes(m);
+
+    if (cols > m->col_capacity)
+    {
+        int capacity = m->col_capacity * 2 > cols ? m->col_capacity * 2 : cols;
+        for (int i = 0; i < m->rows; i++)
+        {
+            double *row = (double *)realloc(m->entries[i], capacity * sizeof(double));
+            if (!row)
+            {
+                printf("(matrix_resize) Memory allocation failed\n");
+                exit(EXIT_FAILURE);
+            }
+            m->entries[i] = row;
+        }
+        m->col_capacity = capacity;
+    }
+    for (int i = 0; i < m->rows && cols > m->cols; i++)
+        memset(m->entries[i] + m->cols, 0, (cols - m->cols) * sizeof(double));
+
+    if (rows > m->row_capacity)
+    {
+        int capacity = m->row_capacity * 2 > rows ? m->row_capacity * 2 : rows;
+        double **entries = (double **)realloc(m->entries, capacity * sizeof(double *));
+        if (!entries)
+        {
+            printf("(matrix_resize) Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        m->entries = entries;
+        m->row_capacity = capacity;
+    }
+    for (int i = m->rows; i < rows; i++)
+    {
+        m->entries[i] = (double *)calloc(m->col_capacity > 0 ? m->col_capacity : 1, sizeof(double));
+        if (!m->entries[i])
+        {
+            printf("(matrix_resize) Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = rows; i < m->rows; i++)
+        free(m->entries[i]);
+
+    m->rows = rows;
+    m->cols = cols;
+    memory_reaccount(m, old_bytes);
+}
+
 void matrix_fill(Matrix *m, double n)
 {
     for (int i = 0; i < m->rows; i++)
@@ -138,7 +414,10 @@ Matrix *matrix_load(FILE *file)
         for (int j = 0; j < m->cols; j++)
         {
             if (!fgets(entry, MAXCHAR, file))
+            {
+                matrix_free(m); // Truncated file
                 return NULL;
+            }
             m->entries[i][j] = strtod(entry, NULL);
         }
     }
@@ -329,8 +608,289 @@ Matrix *matrix_multiply(Matrix *m1, Matrix *m2)
     }
 }
 
+// Tuned kernels
+// Every configuration computes each output with one accumulator summing over
+// the inner dimension in ascending order, like the plain loop in matrix_dot,
+// so results are bit-identical whichever configuration a host picks.
+typedef struct
+{
+    int rows, inner, cols;
+    MatrixKernel kernel;
+} KernelEntry;
+
+static KernelEntry kernels[MAX_KERNEL_SHAPES];
+static int num_kernels = 0;
+
+static const MatrixKernel *kernel_lookup(int rows, int inner, int cols)
+{
+    for (int i = 0; i < num_kernels; i++)
+    {
+        if (kernels[i].rows == rows && kernels[i].inner == inner && kernels[i].cols == cols)
+            return &kernels[i].kernel;
+    }
+    return NULL;
+}
+
+void matrix_kernel_set(int rows, int inner, int cols, MatrixKernel kernel)
+{
+    MatrixKernel *existing = (MatrixKernel *)kernel_lookup(rows, inner, cols);
+    if (existing)
+        *existing = kernel;
+    else if (num_kernels < MAX_KERNEL_SHAPES)
+        kernels[num_kernels++] = (KernelEntry){rows, inner, cols, kernel};
+}
+
+int matrix_kernel_get(int rows, int inner, int cols, MatrixKernel *kernel)
+{
+    const MatrixKernel *found = kernel_lookup(rows, inner, cols);
+    if (found)
+        *kernel = *found;
+    return found != NULL;
+}
+
+void matrix_kernel_clear(void)
+{
+    num_kernels = 0;
+}
+
+// y[i] (+)= rows[i] . x over [k0, k1) for UNROLL rows at a time
+#define DEFINE_ROWS_DOT(UNROLL)                                                             \
+    static void rows_dot_##UNROLL(double *const *rows, const double *x, int k0, int k1, double *y) \
+    {                                                                                       \
+        double acc[UNROLL];                                                                 \
+        for (int u = 0; u < UNROLL; u++)                                                    \
+            acc[u] = k0 == 0 ? 0.0 : y[u];                                                  \
+        for (int k = k0; k < k1; k++)                                                       \
+        {                                                                                   \
+            for (int u = 0; u < UNROLL; u++)                                                \
+                acc[u] += rows[u][k] * x[k];                                                \
+        }                                                                                   \
+        for (int u = 0; u < UNROLL; u++)                                                    \
+            y[u] = acc[u];                                                                  \
+    }
+
+DEFINE_ROWS_DOT(1)
+DEFINE_ROWS_DOT(2)
+DEFINE_ROWS_DOT(4)
+DEFINE_ROWS_DOT(8)
+
+// One thread's rows of y = m * x
+typedef struct
+{
+    const Matrix *m;
+    const double *x;
+    double *y;
+    int row_begin;
+    int row_end;
+    MatrixKernel kernel;
+    int count; // Vectors in x and y, back to back: 1, or a multiple of MATRIX_BATCH_GROUP
+} GemvTask;
+
+// Rows of y[c] = m * x[c] for groups of four vectors, which share each pair
+// of rows of m while it is in cache. Every output sums in the same order as
+// for a single vector, so the results are identical; unroll does not apply.
+static void gemv_batch_rows(GemvTask *task)
+{
+    const Matrix *m = task->m;
+    size_t rows = m->rows, cols = m->cols;
+    size_t block = task->kernel.block > 0 ? (size_t)task->kernel.block : cols > 0 ? cols : 1;
+    for (size_t k0 = 0; k0 == 0 || k0 < cols; k0 += block) // One pass even for empty rows, to write zeros
+    {
+        size_t k1 = k0 + block < cols ? k0 + block : cols;
+        for (int i = task->row_begin; i < task->row_end; i += 2)
+        {
+            int pair = i + 1 < task->row_end;
+            const double *r0 = m->entries[i];
+            const double *r1 = pair ? m->entries[i + 1] : r0; // Odd tail row computed twice
+            for (int c = 0; c < task->count; c += MATRIX_BATCH_GROUP)
+            {
+                const double *x0 = task->x + c * cols, *x1 = x0 + cols, *x2 = x1 + cols, *x3 = x2 + cols;
+                double *y0 = task->y + c * rows + i;
+                double a0 = 0.0, a1 = 0.0, a2 = 0.0, a3 = 0.0, b0 = 0.0, b1 = 0.0, b2 = 0.0, b3 = 0.0;
+                if (k0 > 0)
+                {
+                    a0 = y0[0], a1 = y0[rows], a2 = y0[2 * rows], a3 = y0[3 * rows];
+                    if (pair)
+                        b0 = y0[1], b1 = y0[rows + 1], b2 = y0[2 * rows + 1], b3 = y0[3 * rows + 1];
+                }
+                for (size_t k = k0; k < k1; k++)
+                {
+                    a0 += r0[k] * x0[k];
+                    a1 += r0[k] * x1[k];
+                    a2 += r0[k] * x2[k];
+                    a3 += r0[k] * x3[k];
+                    b0 += r1[k] * x0[k];
+                    b1 += r1[k] * x1[k];
+                    b2 += r1[k] * x2[k];
+                    b3 += r1[k] * x3[k];
+                }
+                y0[0] = a0;
+                y0[rows] = a1;
+                y0[2 * rows] = a2;
+                y0[3 * rows] = a3;
+                if (pair)
+                {
+                    y0[1] = b0;
+                    y0[rows + 1] = b1;
+                    y0[2 * rows + 1] = b2;
+                    y0[3 * rows + 1] = b3;
+                }
+            }
+        }
+    }
+}
+
+static void *gemv_rows(void *arg)
+{
+    GemvTask *task = (GemvTask *)arg;
+    if (task->count > 1)
+    {
+        gemv_batch_rows(task);
+        return NULL;
+    }
+    int inner = task->m->cols;
+    int block = task->kernel.block > 0 ? task->kernel.block : inner;
+    int unroll = task->kernel.unroll;
+    double *const *rows = task->m->entries;
+
+    if (inner == 0)
+    {
+        for (int i = task->row_begin; i < task->row_end; i++)
+            task->y[i] = 0.0;
+        return NULL;
+    }
+
+    // Cache blocking over the inner dimension keeps a slice of x hot across rows
+    for (int k0 = 0; k0 < inner; k0 += block)
+    {
+        int k1 = k0 + block < inner ? k0 + block : inner;
+        int i = task->row_begin;
+        for (; unroll >= 8 && i + 8 <= task->row_end; i += 8)
+            rows_dot_8(rows + i, task->x, k0, k1, task->y + i);
+        for (; unroll >= 4 && i + 4 <= task->row_end; i += 4)
+            rows_dot_4(rows + i, task->x, k0, k1, task->y + i);
+        for (; unroll >= 2 && i + 2 <= task->row_end; i += 2)
+            rows_dot_2(rows + i, task->x, k0, k1, task->y + i);
+        for (; i < task->row_end; i++)
+            rows_dot_1(rows + i, task->x, k0, k1, task->y + i);
+    }
+    return NULL;
+}
+
+// Helper threads for threaded GEMV, started on first use and kept for the
+// life of the process: a single vector takes microseconds, less than
+// creating and joining threads for it would
+typedef struct
+{
+    pthread_mutex_t dispatch; // Held by the caller whose product the pool is running
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    int num_workers;
+    GemvTask *tasks;          // Tasks of the current product, on the caller's stack
+    int next;                 // Next task for a worker to take
+    int count;                // Tasks handed to the pool in this round
+    int pending;              // Taken or untaken tasks not finished yet
+} GemvPool;
+
+static GemvPool gemv_pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                             PTHREAD_COND_INITIALIZER, 0, NULL, 0, 0, 0};
+static pthread_once_t gemv_pool_once = PTHREAD_ONCE_INIT;
+
+static void *gemv_worker(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&gemv_pool.lock);
+    for (;;)
+    {
+        while (gemv_pool.next >= gemv_pool.count)
+            pthread_cond_wait(&gemv_pool.start, &gemv_pool.lock);
+        GemvTask *task = &gemv_pool.tasks[gemv_pool.next++];
+        pthread_mutex_unlock(&gemv_pool.lock);
+        gemv_rows(task);
+        pthread_mutex_lock(&gemv_pool.lock);
+        if (--gemv_pool.pending == 0)
+            pthread_cond_signal(&gemv_pool.done);
+    }
+    return NULL;
+}
+
+// A forked child (e.g. a data-parallel worker) has none of the parent's threads
+static void gemv_pool_after_fork(void)
+{
+    pthread_mutex_init(&gemv_pool.dispatch, NULL);
+    pthread_mutex_init(&gemv_pool.lock, NULL);
+    pthread_cond_init(&gemv_pool.start, NULL);
+    pthread_cond_init(&gemv_pool.done, NULL);
+    gemv_pool.num_workers = 0;
+    gemv_pool.next = gemv_pool.count = gemv_pool.pending = 0;
+}
+
+static void gemv_pool_register(void)
+{
+    pthread_atfork(NULL, NULL, gemv_pool_after_fork);
+}
+
+// count is 1, or a multiple of MATRIX_BATCH_GROUP for a batch
+static void gemv_kernel(const Matrix *m, const double *x, double *y, int count, MatrixKernel kernel)
+{
+    int threads = kernel.threads;
+    if (threads > m->rows)
+        threads = m->rows;
+    if (threads > MAX_KERNEL_THREADS)
+        threads = MAX_KERNEL_THREADS;
+    if (threads < 1)
+        threads = 1;
+
+    // Split the rows across threads; the calling thread takes the first share
+    GemvTask tasks[MAX_KERNEL_THREADS];
+    for (int t = 0; t < threads; t++)
+        tasks[t] = (GemvTask){m, x, y, (int)((long)m->rows * t / threads), (int)((long)m->rows * (t + 1) / threads),
+                              kernel, count};
+
+    // While another thread's product holds the pool, this one runs alone
+    if (threads == 1 || pthread_mutex_trylock(&gemv_pool.dispatch) != 0)
+    {
+        for (int t = 0; t < threads; t++)
+            gemv_rows(&tasks[t]);
+        return;
+    }
+
+    pthread_once(&gemv_pool_once, gemv_pool_register);
+    pthread_mutex_lock(&gemv_pool.lock);
+    while (gemv_pool.num_workers < threads - 1)
+    {
+        pthread_t worker;
+        if (pthread_create(&worker, NULL, gemv_worker, NULL) != 0)
+            break;
+        pthread_detach(worker);
+        gemv_pool.num_workers++;
+    }
+    int helpers = gemv_pool.num_workers < threads - 1 ? gemv_pool.num_workers : threads - 1;
+    gemv_pool.tasks = tasks;
+    gemv_pool.next = 1;
+    gemv_pool.count = 1 + helpers;
+    gemv_pool.pending = helpers;
+    pthread_cond_broadcast(&gemv_pool.start);
+    pthread_mutex_unlock(&gemv_pool.lock);
+
+    gemv_rows(&tasks[0]);
+    for (int t = 1 + helpers; t < threads; t++)
+        gemv_rows(&tasks[t]); // Shares no helper could be started for
+
+    pthread_mutex_lock(&gemv_pool.lock);
+    while (gemv_pool.pending > 0)
+        pthread_cond_wait(&gemv_pool.done, &gemv_pool.lock);
+    pthread_mutex_unlock(&gemv_pool.lock);
+    pthread_mutex_unlock(&gemv_pool.dispatch);
+}
+
 Matrix *matrix_dot(Matrix *m1, Matrix *m2)
 {
+    const MatrixKernel *kernel = kernel_lookup(m1->rows, m1->cols, m2->cols);
+    if (kernel && m1->cols == m2->rows)
+        return matrix_dot_kernel(m1, m2, *kernel);
+
     if (m1->cols == m2->rows)
     {
         Matrix *m = matrix_create(m1->rows, m2->cols);
@@ -355,6 +915,67 @@ Matrix *matrix_dot(Matrix *m1, Matrix *m2)
     }
 }
 
+// matrix_dot with an explicit kernel configuration, one column of m2 at a time
+Matrix *matrix_dot_kernel(Matrix *m1, Matrix *m2, MatrixKernel kernel)
+{
+    if (m1->cols != m2->rows)
+    {
+        printf("(matrix_dot_kernel) Dimensions mismatch dot: %dx%d %dx%d\n", m1->rows, m1->cols, m2->rows, m2->cols);
+        exit(EXIT_FAILURE);
+    }
+
+    Matrix *m = matrix_create(m1->rows, m2->cols);
+    double *x = (double *)malloc((m2->rows + m1->rows) * sizeof(double));
+    if (!x)
+    {
+        printf("(matrix_dot_kernel) Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    double *y = x + m2->rows;
+    for (int j = 0; j < m2->cols; j++)
+    {
+        // Pack the column so the inner loop reads contiguous memory
+        for (int k = 0; k < m2->rows; k++)
+            x[k] = m2->entries[k][j];
+        gemv_kernel(m1, x, y, 1, kernel);
+        for (int i = 0; i < m1->rows; i++)
+            m->entries[i][j] = y[i];
+    }
+    free(x);
+    return m;
+}
+
+// y = m * x for contiguous vectors, using the tuned kernel for the shape if any
+void matrix_gemv(const Matrix *m, const double *x, double *y)
+{
+    const MatrixKernel *kernel = kernel_lookup(m->rows, m->cols, 1);
+    MatrixKernel plain = {0, 1, 1};
+    gemv_kernel(m, x, y, 1, kernel ? *kernel : plain);
+}
+
+// y[c] = m * x[c] for count contiguous vectors, using the kernel tuned for
+// the (rows, cols, MATRIX_BATCH_GROUP) shape if any. Results are identical
+// to matrix_gemv on each vector.
+void matrix_gemv_batch(const Matrix *m, const double *x, int count, double *y)
+{
+    const MatrixKernel *kernel = kernel_lookup(m->rows, m->cols, MATRIX_BATCH_GROUP);
+    MatrixKernel plain = {0, 1, 1};
+    matrix_gemv_batch_kernel(m, x, count, y, kernel ? *kernel : plain);
+}
+
+// matrix_gemv_batch with an explicit kernel configuration for the groups
+void matrix_gemv_batch_kernel(const Matrix *m, const double *x, int count, double *y, MatrixKernel kernel)
+{
+    int grouped = count / MATRIX_BATCH_GROUP * MATRIX_BATCH_GROUP;
+    if (grouped > 0)
+        gemv_kernel(m, x, y, grouped, kernel);
+
+    // Leftover vectors go through the tuned single-vector kernel
+    size_t rows = m->rows, cols = m->cols;
+    for (int c = grouped; c < count; c++)
+        matrix_gemv(m, x + c * cols, y + c * rows);
+}
+
 Matrix *matrix_apply(double (*func)(double), Matrix *m)
 {
     Matrix *mat = matrix_copy(m);
@@ -406,3 +1027,100 @@ Matrix *matrix_transpose(Matrix *m)
     }
     return mat;
 }
+
+// Eigen decomposition of a symmetric matrix by cyclic Jacobi rotations.
+// values receives the eigenvalues in descending order and the columns of
+// vectors (same size as m) the matching unit eigenvectors.
+void matrix_symmetric_eigen(Matrix *m, double *values, Matrix *vectors)
+{
+    int n = m->rows;
+    if (m->cols != n || vectors->rows != n || vectors->cols != n)
+    {
+        printf("(matrix_symmetric_eigen) Dimensions mismatch: %dx%d %dx%d\n", m->rows, m->cols, vectors->rows, vectors->cols);
+        exit(EXIT_FAILURE);
+    }
+
+    Matrix *a = matrix_copy(m);
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j < n; j++)
+            vectors->entries[i][j] = i == j ? 1.0 : 0.0;
+    }
+
+    for (int sweep = 0; sweep < 100; sweep++)
+    {
+        double off = 0.0, total = 0.0;
+        for (int i = 0; i < n; i++)
+        {
+            for (int j = 0; j < n; j++)
+            {
+                total += a->entries[i][j] * a->entries[i][j];
+                if (i != j)
+                    off += a->entries[i][j] * a->entries[i][j];
+            }
+        }
+        if (off <= 1e-22 * total)
+            break;
+
+        for (int p = 0; p < n - 1; p++)
+        {
+            for (int q = p + 1; q < n; q++)
+            {
+                double apq = a->entries[p][q];
+                if (fabs(apq) < 1e-300)
+                    continue;
+
+                // Rotation that zeroes a[p][q]
+                double theta = (a->entries[q][q] - a->entries[p][p]) / (2.0 * apq);
+                double t = (theta >= 0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+                double c = 1.0 / sqrt(t * t + 1.0);
+                double s = t * c;
+
+                for (int k = 0; k < n; k++)
+                {
+                    double akp = a->entries[k][p], akq = a->entries[k][q];
+                    a->entries[k][p] = c * akp - s * akq;
+                    a->entries[k][q] = s * akp + c * akq;
+                }
+                for (int k = 0; k < n; k++)
+                {
+                    double apk = a->entries[p][k], aqk = a->entries[q][k];
+                    a->entries[p][k] = c * apk - s * aqk;
+                    a->entries[q][k] = s * apk + c * aqk;
+                }
+                for (int k = 0; k < n; k++)
+                {
+                    double vkp = vectors->entries[k][p], vkq = vectors->entries[k][q];
+                    vectors->entries[k][p] = c * vkp - s * vkq;
+                    vectors->entries[k][q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < n; i++)
+        values[i] = a->entries[i][i];
+    matrix_free(a);
+
+    // Selection sort into descending order, swapping eigenvector columns along
+    for (int i = 0; i < n - 1; i++)
+    {
+        int best = i;
+        for (int j = i + 1; j < n; j++)
+        {
+            if (values[j] > values[best])
+                best = j;
+        }
+        if (best == i)
+            continue;
+        double tmp = values[i];
+        values[i] = values[best];
+        values[best] = tmp;
+        for (int k = 0; k < n; k++)
+        {
+            tmp = vectors->entries[k][i];
+            vectors->entries[k][i] = vectors->entries[k][best];
+            vectors->entries[k][best] = tmp;
+        }
+    }
+}
@@ -1,12 +1,28 @@
 #pragma once
 
 #include <stdio.h>
+#include <stddef.h>
+
+// What a matrix holds, for splitting memory use into weights, gradients and the rest
+typedef enum
+{
+    MATRIX_MEMORY_WORKSPACE, // Default for every new matrix
+    MATRIX_MEMORY_WEIGHTS,
+    MATRIX_MEMORY_GRADIENTS,
+    MATRIX_MEMORY_CLASSES
+} MatrixMemoryClass;
 
 typedef struct
 {
     double **entries;
     int rows;
     int cols;
+    int row_capacity; // Length of entries; grows geometrically in matrix_resize
+    int col_capacity; // Doubles allocated per row
+    MatrixMemoryClass memory_class;
+#ifdef MATRIX_TRACK_ALLOCATIONS
+    int alloc_site; // Index of the allocating call site
+#endif
 } Matrix;
 
 // Matrix Creation, Management, and Basic Utilities
@@ -15,6 +31,7 @@ void matrix_free(Matrix *m);
 void matrix_fill(Matrix *m, double n);
 Matrix *matrix_zero(int row, int col);
 Matrix *matrix_copy(Matrix *m);
+void matrix_resize(Matrix *m, int rows, int cols); // In place; new entries are zero
 void matrix_print(Matrix *m);
 void matrix_print_dimensions(Matrix *m);
 
@@ -39,4 +56,77 @@ Matrix *matrix_dot(Matrix *m1, Matrix *m2);
 Matrix *matrix_apply(double (*func)(double), Matrix *m);
 Matrix *matrix_scale(double n, Matrix *m);
 Matrix *matrix_addScalar(double n, Matrix *m);
-Matrix *matrix_transpose(Matrix *m);
\ No newline at end of file
+Matrix *matrix_transpose(Matrix *m);
+
+// Kernel Tuning
+// A kernel configuration can be registered per (rows, inner, cols) shape of a
+// product; matrix_dot and matrix_gemv then use it. matrix_gemv_batch uses the
+// one for (rows, inner, MATRIX_BATCH_GROUP), since it works on groups of that
+// many vectors. All configurations give bit-identical results. Register
+// kernels before starting threads.
+#define MATRIX_BATCH_GROUP 4
+
+typedef struct
+{
+    int block;   // Columns of the left matrix per cache block, 0 for no blocking
+    int unroll;  // Rows computed together: 1, 2, 4 or 8
+    int threads; // Threads splitting the rows
+} MatrixKernel;
+
+// Shape of a product: (rows x inner) * (inner x cols)
+typedef struct
+{
+    int rows;
+    int inner;
+    int cols;
+} MatrixShape;
+
+void matrix_kernel_set(int rows, int inner, int cols, MatrixKernel kernel);
+int matrix_kernel_get(int rows, int inner, int cols, MatrixKernel *kernel);
+void matrix_kernel_clear(void);
+Matrix *matrix_dot_kernel(Matrix *m1, Matrix *m2, MatrixKernel kernel);
+void matrix_gemv(const Matrix *m, const double *x, double *y); // y = m * x
+void matrix_gemv_batch(const Matrix *m, const double *x, int count, double *y);
+void matrix_gemv_batch_kernel(const Matrix *m, const double *x, int count, double *y, MatrixKernel kernel);
+
+// Decompositions
+void matrix_symmetric_eigen(Matrix *m, double *values, Matrix *vectors);
+
+// Memory Accounting
+// Live and peak matrix bytes are always counted. Building with
+// -DMATRIX_TRACK_ALLOCATIONS additionally attributes every matrix to the
+// source line that allocated it, for high-water marks and leak reports.
+size_t matrix_memory_bytes(const Matrix *m);
+size_t matrix_memory_live_bytes(void);
+size_t matrix_memory_peak_bytes(void);
+long matrix_memory_live_count(void);
+void matrix_memory_reset_peak(void);
+// Bytes are also counted per MatrixMemoryClass. New matrices take the class
+// set for the allocating thread, so e.g. gradients never count as workspace.
+MatrixMemoryClass matrix_memory_set_class(MatrixMemoryClass memory_class); // Returns the previous class
+void matrix_memory_classify(Matrix *m, MatrixMemoryClass memory_class);    // Move m's bytes to another class
+size_t matrix_memory_class_live_bytes(MatrixMemoryClass memory_class);
+size_t matrix_memory_class_peak_bytes(MatrixMemoryClass memory_class);
+void matrix_memory_report(FILE *out, const char *label);
+long matrix_memory_report_leaks(FILE *out);
+
+#ifdef MATRIX_TRACK_ALLOCATIONS
+void matrix_track_site(const char *file, int line);
+#ifndef MATRIX_IMPLEMENTATION
+#define MATRIX_TRACKED(call) (matrix_track_site(__FILE__, __LINE__), call)
+#define matrix_create(row, col) MATRIX_TRACKED(matrix_create(row, col))
+#define matrix_zero(row, col) MATRIX_TRACKED(matrix_zero(row, col))
+#define matrix_copy(m) MATRIX_TRACKED(matrix_copy(m))
+#define matrix_load(file) MATRIX_TRACKED(matrix_load(file))
+#define matrix_row(m, row_index) MATRIX_TRACKED(matrix_row(m, row_index))
+#define matrix_add(m1, m2) MATRIX_TRACKED(matrix_add(m1, m2))
+#define matrix_subtract(m1, m2) MATRIX_TRACKED(matrix_subtract(m1, m2))
+#define matrix_multiply(m1, m2) MATRIX_TRACKED(matrix_multiply(m1, m2))
+#define matrix_dot(m1, m2) MATRIX_TRACKED(matrix_dot(m1, m2))
+#define matrix_dot_kernel(m1, m2, kernel) MATRIX_TRACKED(matrix_dot_kernel(m1, m2, kernel))
+#define matrix_apply(func, m) MATRIX_TRACKED(matrix_apply(func, m))
+#define matrix_scale(n, m) MATRIX_TRACKED(matrix_scale(n, m))
+#define matrix_addScalar(n, m) MATRIX_TRACKED(matrix_addScalar(n, m))
+#define matrix_transpose(m) MATRIX_TRACKED(matrix_transpose(m))
+#endif
+#endif
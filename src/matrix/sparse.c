@@ -0,0 +1,385 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+#include "sparse.h"
+
+static void *sparse_alloc(size_t size)
+{
+    void *p = malloc(size ? size : 1);
+    if (!p)
+    {
+        fprintf(stderr, "Error: Unable to allocate memory for sparse matrix\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+SparseMatrix *sparse_from_matrix(Matrix *m)
+{
+    SparseMatrix *s = (SparseMatrix *)sparse_alloc(sizeof(SparseMatrix));
+    s->rows = m->rows;
+    s->cols = m->cols;
+    s->nnz = 0;
+    for (int i = 0; i < m->rows; i++)
+    {
+        for (int j = 0; j < m->cols; j++)
+            s->nnz += m->entries[i][j] != 0.0;
+    }
+
+    s->row_ptr = (int *)sparse_alloc((m->rows + 1) * sizeof(int));
+    s->col_idx = (int *)sparse_alloc(s->nnz * sizeof(int));
+    s->values = (double *)sparse_alloc(s->nnz * sizeof(double));
+
+    int k = 0;
+    for (int i = 0; i < m->rows; i++)
+    {
+        s->row_ptr[i] = k;
+        for (int j = 0; j < m->cols; j++)
+        {
+            if (m->entries[i][j] != 0.0)
+            {
+                s->col_idx[k] = j;
+                s->values[k] = m->entries[i][j];
+                k++;
+            }
+        }
+    }
+    s->row_ptr[m->rows] = k;
+    return s;
+}
+
+Matrix *sparse_to_matrix(const SparseMatrix *s)
+{
+    Matrix *m = matrix_zero(s->rows, s->cols);
+    for (int i = 0; i < s->rows; i++)
+    {
+        for (int k = s->row_ptr[i]; k < s->row_ptr[i + 1]; k++)
+            m->entries[i][s->col_idx[k]] = s->values[k];
+    }
+    return m;
+}
+
+void sparse_free(SparseMatrix *s)
+{
+    if (s)
+    {
+        free(s->row_ptr);
+        free(s->col_idx);
+        free(s->values);
+        free(s);
+    }
+}
+
+// Keep the sparsity pattern fixed while the dense weights are fine-tuned
+void sparse_refresh_values(SparseMatrix *s, Matrix *m)
+{
+    for (int i = 0; i < s->rows; i++)
+    {
+        int next = 0;
+        for (int k = s->row_ptr[i]; k < s->row_ptr[i + 1]; k++)
+        {
+            int col = s->col_idx[k];
+            for (; next < col; next++)
+                m->entries[i][next] = 0.0;
+            s->values[k] = m->entries[i][col];
+            next = col + 1;
+        }
+        for (; next < s->cols; next++)
+            m->entries[i][next] = 0.0;
+    }
+}
+
+size_t sparse_memory_bytes(const SparseMatrix *s)
+{
+    return sizeof(SparseMatrix) + (s->rows + 1) * sizeof(int) + (size_t)s->nnz * (sizeof(int) + sizeof(double));
+}
+
+double sparse_density(const SparseMatrix *s)
+{
+    return s->rows && s->cols ? (double)s->nnz / ((double)s->rows * s->cols) : 0.0;
+}
+
+void sparse_save(SparseMatrix *s, FILE *file)
+{
+    int dims[3] = {s->rows, s->cols, s->nnz};
+    fwrite(dims, sizeof(int), 3, file);
+    fwrite(s->row_ptr, sizeof(int), s->rows + 1, file);
+    fwrite(s->col_idx, sizeof(int), s->nnz, file);
+    fwrite(s->values, sizeof(double), s->nnz, file);
+}
+
+SparseMatrix *sparse_load(FILE *file)
+{
+    int dims[3];
+    if (fread(dims, sizeof(int), 3, file) != 3 || dims[0] < 0 || dims[1] < 0 || dims[2] < 0)
+        return NULL;
+
+    SparseMatrix *s = (SparseMatrix *)sparse_alloc(sizeof(SparseMatrix));
+    s->rows = dims[0];
+    s->cols = dims[1];
+    s->nnz = dims[2];
+    s->row_ptr = (int *)sparse_alloc((s->rows + 1) * sizeof(int));
+    s->col_idx = (int *)sparse_alloc(s->nnz * sizeof(int));
+    s->values = (double *)sparse_alloc(s->nnz * sizeof(double));
+
+    int ok = fread(s->row_ptr, sizeof(int), s->rows + 1, file) == (size_t)s->rows + 1 &&
+             fread(s->col_idx, sizeof(int), s->nnz, file) == (size_t)s->nnz &&
+             fread(s->values, sizeof(double), s->nnz, file) == (size_t)s->nnz &&
+             s->row_ptr[0] == 0 && s->row_ptr[s->rows] == s->nnz;
+    for (int i = 0; ok && i < s->rows; i++)
+        ok = s->row_ptr[i] <= s->row_ptr[i + 1]; // With both ends fixed, keeps every row in range
+    for (int k = 0; ok && k < s->nnz; k++)
+        ok = s->col_idx[k] >= 0 && s->col_idx[k] < s->cols;
+    if (!ok)
+    {
+        sparse_free(s); // Truncated or corrupted
+        return NULL;
+    }
+    return s;
+}
+
+void sparse_save_blocks(const SparseMatrix *s, int block_cols, FILE *file)
+{
+    // Column indices are sorted within a row, so a new block starts wherever the block index changes
+    int *block_ptr = (int *)sparse_alloc((s->rows + 1) * sizeof(int));
+    int num_blocks = 0;
+    for (int i = 0; i < s->rows; i++)
+    {
+        block_ptr[i] = num_blocks;
+        for (int k = s->row_ptr[i], last = -1; k < s->row_ptr[i + 1]; k++)
+        {
+            int block = s->col_idx[k] / block_cols;
+            num_blocks += block != last;
+            last = block;
+        }
+    }
+    block_ptr[s->rows] = num_blocks;
+
+    int *block_idx = (int *)sparse_alloc(num_blocks * sizeof(int));
+    double *values = (double *)sparse_alloc((size_t)num_blocks * block_cols * sizeof(double));
+    memset(values, 0, (size_t)num_blocks * block_cols * sizeof(double));
+    for (int i = 0, n = -1; i < s->rows; i++)
+    {
+        for (int k = s->row_ptr[i], last = -1; k < s->row_ptr[i + 1]; k++)
+        {
+            int block = s->col_idx[k] / block_cols;
+            if (block != last)
+                block_idx[++n] = block;
+            last = block;
+            values[(size_t)n * block_cols + s->col_idx[k] % block_cols] = s->values[k];
+        }
+    }
+
+    int dims[4] = {s->rows, s->cols, block_cols, num_blocks};
+    fwrite(dims, sizeof(int), 4, file);
+    fwrite(block_ptr, sizeof(int), s->rows + 1, file);
+    fwrite(block_idx, sizeof(int), num_blocks, file);
+    fwrite(values, sizeof(double), (size_t)num_blocks * block_cols, file);
+    free(block_ptr);
+    free(block_idx);
+    free(values);
+}
+
+SparseMatrix *sparse_load_blocks(FILE *file, int *block_cols)
+{
+    int dims[4];
+    if (fread(dims, sizeof(int), 4, file) != 4 || dims[0] < 0 || dims[1] < 0 || dims[2] < 1 || dims[3] < 0)
+        return NULL;
+    int rows = dims[0], cols = dims[1], width = dims[2], num_blocks = dims[3];
+    size_t num_values = (size_t)num_blocks * width;
+
+    int *block_ptr = (int *)sparse_alloc((rows + 1) * sizeof(int));
+    int *block_idx = (int *)sparse_alloc(num_blocks * sizeof(int));
+    double *values = (double *)sparse_alloc(num_values * sizeof(double));
+    int ok = fread(block_ptr, sizeof(int), rows + 1, file) == (size_t)rows + 1 &&
+             fread(block_idx, sizeof(int), num_blocks, file) == (size_t)num_blocks &&
+             fread(values, sizeof(double), num_values, file) == num_values && block_ptr[0] == 0 &&
+             block_ptr[rows] == num_blocks;
+    for (int i = 0; ok && i < rows; i++)
+        ok = block_ptr[i] <= block_ptr[i + 1];
+    // Blocks of a row must be in range and in increasing order, as CSR columns are
+    for (int i = 0; ok && i < rows; i++)
+    {
+        for (int n = block_ptr[i]; ok && n < block_ptr[i + 1]; n++)
+            ok = block_idx[n] >= 0 && (long)block_idx[n] * width < cols &&
+                 (n == block_ptr[i] || block_idx[n] > block_idx[n - 1]);
+    }
+
+    SparseMatrix *s = NULL;
+    if (ok)
+    {
+        // Expand to CSR, dropping the zeros that padded partial blocks
+        s = (SparseMatrix *)sparse_alloc(sizeof(SparseMatrix));
+        s->rows = rows;
+        s->cols = cols;
+        s->nnz = 0;
+        for (size_t v = 0; v < num_values; v++)
+            s->nnz += values[v] != 0.0;
+        s->row_ptr = (int *)sparse_alloc((rows + 1) * sizeof(int));
+        s->col_idx = (int *)sparse_alloc(s->nnz * sizeof(int));
+        s->values = (double *)sparse_alloc(s->nnz * sizeof(double));
+        int k = 0;
+        for (int i = 0; i < rows; i++)
+        {
+            s->row_ptr[i] = k;
+            for (int n = block_ptr[i]; n < block_ptr[i + 1]; n++)
+            {
+                for (int j = 0; j < width && block_idx[n] * width + j < cols; j++)
+                {
+                    double value = values[(size_t)n * width + j];
+                    if (value != 0.0)
+                    {
+                        s->col_idx[k] = block_idx[n] * width + j;
+                        s->values[k++] = value;
+                    }
+                }
+            }
+        }
+        s->row_ptr[rows] = k;
+        s->nnz = k;
+        *block_cols = width;
+    }
+    free(block_ptr);
+    free(block_idx);
+    free(values);
+    return s; // NULL when truncated or corrupted
+}
+
+void sparse_gemv(const SparseMatrix *s, const double *x, double *y)
+{
+    for (int i = 0; i < s->rows; i++)
+    {
+        int k = s->row_ptr[i];
+        int end = s->row_ptr[i + 1];
+        double sum = 0.0;
+#if defined(__AVX2__) && defined(__FMA__)
+        // Gather four inputs at a time by column index
+        __m256d acc = _mm256_setzero_pd();
+        for (; k + 4 <= end; k += 4)
+        {
+            __m128i idx = _mm_loadu_si128((const __m128i *)&s->col_idx[k]);
+            __m256d xv = _mm256_i32gather_pd(x, idx, sizeof(double));
+            acc = _mm256_fmadd_pd(_mm256_loadu_pd(&s->values[k]), xv, acc);
+        }
+        __m128d half = _mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+        sum = _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+#endif
+        for (; k < end; k++)
+            sum += s->values[k] * x[s->col_idx[k]];
+        y[i] = sum;
+    }
+}
+
+Matrix *sparse_dot(const SparseMatrix *s, Matrix *v)
+{
+    if (s->cols != v->rows || v->cols != 1)
+    {
+        printf("(sparse_dot) Dimensions mismatch dot: %dx%d %dx%d\n", s->rows, s->cols, v->rows, v->cols);
+        exit(EXIT_FAILURE);
+    }
+
+    // Gather the column vector into contiguous memory for the kernel
+    double *x = (double *)sparse_alloc(v->rows * sizeof(double));
+    double *y = (double *)sparse_alloc(s->rows * sizeof(double));
+    for (int j = 0; j < v->rows; j++)
+        x[j] = v->entries[j][0];
+    sparse_gemv(s, x, y);
+
+    Matrix *result = matrix_create(s->rows, 1);
+    for (int i = 0; i < s->rows; i++)
+        result->entries[i][0] = y[i];
+    free(x);
+    free(y);
+    return result;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Value below which the given fraction of scores falls
+static double sparsity_threshold(double *scores, size_t count, double sparsity)
+{
+    if (count == 0 || sparsity <= 0.0)
+        return -1.0;
+    qsort(scores, count, sizeof(double), compare_doubles);
+    size_t cut = (size_t)(sparsity * count);
+    if (cut >= count)
+        return INFINITY;
+    return cut == 0 ? -1.0 : scores[cut - 1];
+}
+
+// Zero the smallest-magnitude entries until the target sparsity is reached
+double matrix_prune_magnitude(Matrix *m, double sparsity)
+{
+    size_t count = (size_t)m->rows * m->cols;
+    double *scores = (double *)sparse_alloc(count * sizeof(double));
+    for (int i = 0; i < m->rows; i++)
+    {
+        for (int j = 0; j < m->cols; j++)
+            scores[(size_t)i * m->cols + j] = fabs(m->entries[i][j]);
+    }
+    double threshold = sparsity_threshold(scores, count, sparsity);
+    free(scores);
+
+    size_t zeros = 0;
+    for (int i = 0; i < m->rows; i++)
+    {
+        for (int j = 0; j < m->cols; j++)
+        {
+            if (fabs(m->entries[i][j]) <= threshold)
+                m->entries[i][j] = 0.0;
+            zeros += m->entries[i][j] == 0.0;
+        }
+    }
+    return count ? (double)zeros / count : 0.0;
+}
+
+// Zero whole runs of block_cols columns within a row by their L2 norm, so the
+// surviving weights stay contiguous in each row
+double matrix_prune_blocks(Matrix *m, int block_cols, double sparsity)
+{
+    if (block_cols <= 1)
+        return matrix_prune_magnitude(m, sparsity);
+
+    int blocks_per_row = (m->cols + block_cols - 1) / block_cols;
+    size_t count = (size_t)m->rows * blocks_per_row;
+    double *norms = (double *)sparse_alloc(count * sizeof(double));
+    double *scores = (double *)sparse_alloc(count * sizeof(double));
+    for (int i = 0; i < m->rows; i++)
+    {
+        for (int b = 0; b < blocks_per_row; b++)
+        {
+            double sum = 0.0;
+            for (int j = b * block_cols; j < m->cols && j < (b + 1) * block_cols; j++)
+                sum += m->entries[i][j] * m->entries[i][j];
+            norms[(size_t)i * blocks_per_row + b] = scores[(size_t)i * blocks_per_row + b] = sqrt(sum);
+        }
+    }
+    double threshold = sparsity_threshold(scores, count, sparsity);
+    free(scores);
+
+    size_t zeros = 0;
+    for (int i = 0; i < m->rows; i++)
+    {
+        for (int b = 0; b < blocks_per_row; b++)
+        {
+            int prune = norms[(size_t)i * blocks_per_row + b] <= threshold;
+            for (int j = b * block_cols; j < m->cols && j < (b + 1) * block_cols; j++)
+            {
+                if (prune)
+                    m->entries[i][j] = 0.0;
+                zeros += m->entries[i][j] == 0.0;
+            }
+        }
+    }
+    free(norms);
+    return m->rows && m->cols ? (double)zeros / ((double)m->rows * m->cols) : 0.0;
+}
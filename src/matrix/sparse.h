@@ -0,0 +1,39 @@
+#pragma once
+#include <stdio.h>
+#include <stddef.h>
+#include "matrix.h"
+
+// Compressed sparse row matrix
+typedef struct
+{
+    int rows;
+    int cols;
+    int nnz;        // Number of stored (non-zero) entries
+    int *row_ptr;   // rows + 1 offsets into col_idx / values
+    int *col_idx;   // Column of each stored entry
+    double *values; // Value of each stored entry
+} SparseMatrix;
+
+// Creation and conversion
+SparseMatrix *sparse_from_matrix(Matrix *m);
+Matrix *sparse_to_matrix(const SparseMatrix *s); // Dense copy, zeros where nothing is stored
+void sparse_free(SparseMatrix *s);
+void sparse_refresh_values(SparseMatrix *s, Matrix *m); // Re-read values and re-zero pruned entries of m
+size_t sparse_memory_bytes(const SparseMatrix *s);
+double sparse_density(const SparseMatrix *s);
+
+// File Operations
+void sparse_save(SparseMatrix *s, FILE *file);
+SparseMatrix *sparse_load(FILE *file);
+// Block-sparse form for matrices pruned in aligned runs of block_cols columns:
+// one column index per block instead of one per entry. Loads back as CSR.
+void sparse_save_blocks(const SparseMatrix *s, int block_cols, FILE *file);
+SparseMatrix *sparse_load_blocks(FILE *file, int *block_cols);
+
+// Products
+void sparse_gemv(const SparseMatrix *s, const double *x, double *y); // y = s * x
+Matrix *sparse_dot(const SparseMatrix *s, Matrix *v);                // s * v for a column vector v
+
+// Pruning; both return the fraction of entries that are zero afterwards
+double matrix_prune_magnitude(Matrix *m, double sparsity);
+double matrix_prune_blocks(Matrix *m, int block_cols, double sparsity);
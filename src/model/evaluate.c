@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "evaluate.h"
+#include "../vocabulary/vocabulary.h"
+
+// One thread's slice of the token stream and its partial sums
+typedef struct
+{
+    const RNN *rnn;
+    const Dataset *dataset;
+    size_t start;        // First input token
+    size_t end;          // One past the last input token
+    int top_k;
+    double log_loss;     // Summed negative log-likelihood
+    size_t correct;
+    size_t top_k_correct;
+    int failed;          // The slice holds an id outside the vocabulary
+} EvalShard;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// -log softmax(output)[target] and the number of outputs ranked above the target
+static double score_prediction(const double *output, int size, int target, int *rank)
+{
+    double max = output[0];
+    for (int i = 1; i < size; i++)
+        max = output[i] > max ? output[i] : max;
+
+    double sum = 0.0;
+    int above = 0;
+    for (int i = 0; i < size; i++)
+    {
+        sum += exp(output[i] - max);
+        above += output[i] > output[target];
+    }
+    *rank = above;
+    return log(sum) + max - output[target];
+}
+
+static void *evaluate_shard(void *arg)
+{
+    EvalShard *shard = (EvalShard *)arg;
+    const RNN *rnn = shard->rnn;
+    if (shard->start < shard->end && dataset_check_tokens(shard->dataset, shard->start, shard->end + 1) != 0)
+    {
+        shard->failed = 1;
+        return NULL;
+    }
+    RNNState *state = rnn_state_create(rnn);
+
+    for (size_t t = shard->start; t < shard->end; t++)
+    {
+        uint32_t token = dataset_token(shard->dataset, t);
+        uint32_t target = dataset_token(shard->dataset, t + 1);
+        const double *output = rnn_step(rnn, state, token);
+
+        int rank;
+        shard->log_loss += score_prediction(output, rnn->output_size, target, &rank);
+        shard->correct += rank == 0;
+        shard->top_k_correct += rank < shard->top_k;
+
+        // The next input starts a new sentence
+        if (token == VOCAB_EOS)
+            rnn_state_reset(rnn, state);
+    }
+
+    rnn_state_free(state);
+    return NULL;
+}
+
+// Move a shard boundary forward to the next sentence start, if there is one before limit
+static size_t sentence_boundary(const Dataset *dataset, size_t position, size_t limit)
+{
+    for (size_t t = position; t < limit; t++)
+    {
+        if (dataset_token(dataset, t) == VOCAB_EOS)
+            return t + 1;
+    }
+    return position;
+}
+
+int evaluate_model(const RNN *rnn, const Dataset *dataset, int threads, int top_k, EvalResult *result)
+{
+    size_t num_tokens = dataset->header.num_tokens;
+    if ((int)dataset->header.vocab_size != rnn->input_size || rnn->input_size != rnn->output_size)
+    {
+        fprintf(stderr, "Error: Model and token file use different vocabularies\n");
+        return -1;
+    }
+    if (num_tokens < 2 || threads < 1 || top_k < 1)
+    {
+        fprintf(stderr, "Error: Nothing to evaluate\n");
+        return -1;
+    }
+
+    size_t predictions = num_tokens - 1;
+    if ((size_t)threads > predictions)
+        threads = (int)predictions;
+    EvalShard *shards = (EvalShard *)calloc(threads, sizeof(EvalShard));
+    pthread_t *workers = (pthread_t *)malloc(threads * sizeof(pthread_t));
+    if (!shards || !workers)
+    {
+        fprintf(stderr, "Error: Unable to allocate memory for evaluation\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t start = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        size_t end = predictions * (i + 1) / threads;
+        if (i + 1 < threads)
+            end = sentence_boundary(dataset, end, predictions * (i + 2) / threads);
+        if (end < start)
+            end = start;
+        shards[i].rnn = rnn;
+        shards[i].dataset = dataset;
+        shards[i].start = start;
+        shards[i].end = end;
+        shards[i].top_k = top_k;
+        start = end;
+    }
+
+    double begin = now_seconds();
+    int started = 0;
+    for (; started < threads; started++)
+    {
+        if (pthread_create(&workers[started], NULL, evaluate_shard, &shards[started]) != 0)
+            break;
+    }
+    // Whatever could not get a thread runs here
+    for (int i = started; i < threads; i++)
+        evaluate_shard(&shards[i]);
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+    double elapsed = now_seconds() - begin;
+    for (int i = 0; i < threads; i++)
+    {
+        if (shards[i].failed)
+        {
+            free(shards);
+            free(workers);
+            return -1;
+        }
+    }
+
+    // Combine in shard order so the sums are reproducible
+    double log_loss = 0.0;
+    size_t correct = 0, top_k_correct = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        log_loss += shards[i].log_loss;
+        correct += shards[i].correct;
+        top_k_correct += shards[i].top_k_correct;
+    }
+
+    memset(result, 0, sizeof(*result));
+    result->predictions = predictions;
+    result->cross_entropy = log_loss / predictions;
+    result->perplexity = exp(result->cross_entropy);
+    result->accuracy = (double)correct / predictions;
+    result->top_k_accuracy = (double)top_k_correct / predictions;
+    result->top_k = top_k;
+    result->threads = threads;
+    result->seconds = elapsed;
+    result->tokens_per_second = elapsed > 0.0 ? predictions / elapsed : 0.0;
+
+    free(shards);
+    free(workers);
+    return 0;
+}
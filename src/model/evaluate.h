@@ -0,0 +1,26 @@
+#pragma once
+#include <stddef.h>
+#include "rnn.h"
+#include "../data/dataset.h"
+
+// Quality and throughput of a model on a held-out token stream
+typedef struct
+{
+    size_t predictions;       // Next-token predictions scored
+    double cross_entropy;     // Mean negative log-likelihood in nats, softmax over the outputs
+    double perplexity;        // exp(cross_entropy)
+    double accuracy;          // Fraction of targets that are the argmax
+    double top_k_accuracy;    // Fraction of targets among the top_k outputs
+    int top_k;
+    int threads;
+    double seconds;           // Wall-clock time of the evaluation
+    double tokens_per_second;
+} EvalResult;
+
+// Score every next-token prediction of the dataset with the forward-only
+// path. The stream is split at sentence boundaries (VOCAB_EOS) into one shard
+// per thread; each thread keeps its own hidden state, reset at every sentence
+// start, so results do not depend on the thread count as long as every shard
+// boundary can fall on a sentence start. The model is not modified. Returns 0
+// on success.
+int evaluate_model(const RNN *rnn, const Dataset *dataset, int threads, int top_k, EvalResult *result);
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ngram.h"
+
+// qsort has no context argument; building is single-threaded
+static const Dataset *sort_dataset;
+static int sort_length;
+
+// Order positions by the context ending before them, then by the token at them
+static int compare_positions(const void *a, const void *b)
+{
+    size_t pa = *(const size_t *)a, pb = *(const size_t *)b;
+    for (int k = sort_length; k >= 0; k--)
+    {
+        uint32_t ta = dataset_token(sort_dataset, pa - k);
+        uint32_t tb = dataset_token(sort_dataset, pb - k);
+        if (ta != tb)
+            return ta < tb ? -1 : 1;
+    }
+    return 0;
+}
+
+static int same_context(const Dataset *dataset, size_t pa, size_t pb, int length)
+{
+    for (int k = 1; k <= length; k++)
+    {
+        if (dataset_token(dataset, pa - k) != dataset_token(dataset, pb - k))
+            return 0;
+    }
+    return 1;
+}
+
+static void *ngram_alloc(size_t size)
+{
+    void *p = malloc(size ? size : 1);
+    if (!p)
+    {
+        fprintf(stderr, "Error: Unable to allocate memory for the n-gram model\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+// Sort every position by (context, token) and keep the longest run per context
+static void build_table(const Dataset *dataset, int length, size_t *positions, NgramTable *table)
+{
+    size_t num_tokens = dataset->header.num_tokens;
+    size_t n = num_tokens > (size_t)length ? num_tokens - length : 0;
+    for (size_t i = 0; i < n; i++)
+        positions[i] = i + length;
+    sort_dataset = dataset;
+    sort_length = length;
+    qsort(positions, n, sizeof(size_t), compare_positions);
+
+    table->length = length;
+    table->count = 0;
+    table->contexts = (uint32_t *)ngram_alloc(n * length * sizeof(uint32_t));
+    table->next = (uint32_t *)ngram_alloc(n * sizeof(uint32_t));
+
+    size_t i = 0;
+    while (i < n)
+    {
+        // One context spans [i, end); runs of equal next tokens inside it are contiguous
+        size_t end = i + 1;
+        while (end < n && same_context(dataset, positions[i], positions[end], length))
+            end++;
+
+        uint32_t best = dataset_token(dataset, positions[i]);
+        size_t best_count = 0;
+        for (size_t run = i; run < end;)
+        {
+            uint32_t token = dataset_token(dataset, positions[run]);
+            size_t run_end = run + 1;
+            while (run_end < end && dataset_token(dataset, positions[run_end]) == token)
+                run_end++;
+            if (run_end - run > best_count)
+            {
+                best = token;
+                best_count = run_end - run;
+            }
+            run = run_end;
+        }
+
+        uint32_t *context = table->contexts + table->count * length;
+        for (int k = 0; k < length; k++)
+            context[k] = dataset_token(dataset, positions[i] - length + k);
+        table->next[table->count++] = best;
+        i = end;
+    }
+}
+
+NgramModel *ngram_build(const Dataset *dataset, int order)
+{
+    if (order < 2 || order > NGRAM_MAX_ORDER)
+    {
+        fprintf(stderr, "Error: n-gram order must be between 2 and %d\n", NGRAM_MAX_ORDER);
+        return NULL;
+    }
+    size_t num_tokens = dataset->header.num_tokens;
+    if (num_tokens < 2)
+    {
+        fprintf(stderr, "Error: Not enough tokens for an n-gram model\n");
+        return NULL;
+    }
+
+    if (dataset_check_tokens(dataset, 0, num_tokens) != 0)
+        return NULL;
+
+    NgramModel *model = (NgramModel *)ngram_alloc(sizeof(NgramModel));
+    memset(model, 0, sizeof(*model));
+    model->order = order;
+
+    // Most frequent token
+    uint32_t *counts = (uint32_t *)calloc(dataset->header.vocab_size, sizeof(uint32_t));
+    if (!counts)
+    {
+        fprintf(stderr, "Error: Unable to allocate memory for the n-gram model\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < num_tokens; i++)
+    {
+        uint32_t token = dataset_token(dataset, i);
+        if (++counts[token] > counts[model->unigram])
+            model->unigram = token;
+    }
+    free(counts);
+
+    size_t *positions = (size_t *)ngram_alloc(num_tokens * sizeof(size_t));
+    for (int length = 1; length < order; length++)
+        build_table(dataset, length, positions, &model->tables[length - 1]);
+    free(positions);
+    return model;
+}
+
+void ngram_free(NgramModel *model)
+{
+    if (model)
+    {
+        for (int i = 0; i < model->order - 1; i++)
+        {
+            free(model->tables[i].contexts);
+            free(model->tables[i].next);
+        }
+        free(model);
+    }
+}
+
+static int compare_context(const uint32_t *a, const uint32_t *b, int length)
+{
+    for (int k = 0; k < length; k++)
+    {
+        if (a[k] != b[k])
+            return a[k] < b[k] ? -1 : 1;
+    }
+    return 0;
+}
+
+uint32_t ngram_predict(const NgramModel *model, const uint32_t *history, int length)
+{
+    int longest = length < model->order - 1 ? length : model->order - 1;
+    for (int context_length = longest; context_length > 0; context_length--)
+    {
+        const NgramTable *table = &model->tables[context_length - 1];
+        const uint32_t *context = history + length - context_length;
+
+        // Binary search over the sorted contexts
+        size_t low = 0, high = table->count;
+        while (low < high)
+        {
+            size_t mid = low + (high - low) / 2;
+            int cmp = compare_context(table->contexts + mid * context_length, context, context_length);
+            if (cmp == 0)
+                return table->next[mid];
+            if (cmp < 0)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+    }
+    return model->unigram;
+}
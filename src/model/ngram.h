@@ -0,0 +1,29 @@
+#pragma once
+#include <stdint.h>
+#include "../data/dataset.h"
+
+#define NGRAM_MAX_ORDER 6
+
+// Contexts of one length, sorted, with the most frequent next token of each
+typedef struct
+{
+    int length;         // Tokens per context
+    size_t count;       // Distinct contexts
+    uint32_t *contexts; // count * length tokens
+    uint32_t *next;     // Most frequent next token of each context
+} NgramTable;
+
+// Count-based n-gram model used as a cheap draft for speculative decoding
+typedef struct
+{
+    int order;                              // Longest n-gram, context length order - 1
+    NgramTable tables[NGRAM_MAX_ORDER - 1]; // tables[i] holds contexts of length i + 1
+    uint32_t unigram;                       // Most frequent token, the last fallback
+} NgramModel;
+
+// Count n-grams up to the given order over a token file; NULL on failure
+NgramModel *ngram_build(const Dataset *dataset, int order);
+void ngram_free(NgramModel *model);
+
+// Most likely next token after history[0..length), backing off to shorter contexts
+uint32_t ngram_predict(const NgramModel *model, const uint32_t *history, int length);
@@ -3,12 +3,16 @@
 #include <math.h>
 #include <string.h>
 #include <time.h>
+#include <sys/resource.h>
 
 #include "rnn.h"
 #include "../matrix/matrix.h"
+#include "../matrix/expr.h"
+#include "../matrix/autotune.h"
 #include "../vocabulary/vocabulary.h"
 
 #define MAX_WORD_LENGTH 64
+#define MAX_SECTION_NAME 64
 
 RNN *rnn_init(int input_size, int hidden_size, int output_size, double learning_rate)
 {
@@ -24,6 +28,8 @@ RNN *rnn_init(int input_size, int hidden_size, int output_size, double learning_
     rnn->output_size = output_size;
     rnn->learning_rate = learning_rate;
 
+    MatrixMemoryClass memory_class = matrix_memory_set_class(MATRIX_MEMORY_WEIGHTS);
+
     // Initialize hidden weights (input to hidden)
     rnn->hidden_weights = matrix_create(hidden_size, input_size);
     matrix_xavier_randomize(rnn->hidden_weights, input_size, hidden_size);
@@ -34,7 +40,12 @@ RNN *rnn_init(int input_size, int hidden_size, int output_size, double learning_
 
     // Initialize hidden state to zeros
     rnn->hidden_state = matrix_zero(hidden_size, 1);
+    rnn->output_sparse = NULL;
+    rnn->output_block_cols = 1;
+    rnn->output_left = NULL;
+    rnn->output_right = NULL;
 
+    matrix_memory_set_class(memory_class);
     return rnn;
 }
 
@@ -45,30 +56,242 @@ void rnn_free(RNN *rnn)
         matrix_free(rnn->hidden_weights);
         matrix_free(rnn->output_weights);
         matrix_free(rnn->hidden_state);
+        sparse_free(rnn->output_sparse);
+        matrix_free(rnn->output_left);
+        matrix_free(rnn->output_right);
         free(rnn);
     }
 }
 
-Matrix *rnn_forward(RNN *rnn, Matrix *input)
+// Make room for words appended to the vocabulary. Trained weights keep their
+// place; the new input columns and output rows get the Xavier initialization
+// rnn_init would have given them. Matrices grow geometrically, so calling this
+// once per new word is still amortized O(1) reallocations.
+// Rebuild the dense output_weights of a pruned model. Inference only reads
+// the CSR form, so rnn_load leaves it out; training, growing and pruning again
+// need it.
+void rnn_densify_output(RNN *rnn)
+{
+    if (!rnn->output_sparse || rnn->output_weights)
+        return;
+    MatrixMemoryClass memory_class = matrix_memory_set_class(MATRIX_MEMORY_WEIGHTS);
+    rnn->output_weights = sparse_to_matrix(rnn->output_sparse);
+    matrix_memory_set_class(memory_class);
+}
+
+void rnn_grow_vocabulary(RNN *rnn, int vocab_size)
 {
-    // Update hidden state: hidden_state = tanh(hidden_weigths * input + hidden_state)
-    Matrix *hidden_input = matrix_dot(rnn->hidden_weights, input);
-    Matrix *new_hidden_state = matrix_add(hidden_input, rnn->hidden_state);
-    matrix_free(hidden_input);
+    int old_size = rnn->input_size;
+    if (vocab_size <= old_size)
+        return;
+    int added = vocab_size - old_size;
+    rnn_densify_output(rnn);
 
-    // Apply tanh activation to the hidden state
-    Matrix *activated_hidden = matrix_apply(tanh, new_hidden_state);
-    matrix_free(new_hidden_state);
+    matrix_resize(rnn->hidden_weights, rnn->hidden_size, vocab_size);
+    Matrix *fresh = matrix_create(rnn->hidden_size, added);
+    matrix_xavier_randomize(fresh, vocab_size, rnn->hidden_size);
+    for (int i = 0; i < rnn->hidden_size; i++)
+        memcpy(rnn->hidden_weights->entries[i] + old_size, fresh->entries[i], added * sizeof(double));
+    matrix_free(fresh);
 
-    // Update the RNN's hidden state
-    matrix_free(rnn->hidden_state);
-    rnn->hidden_state = matrix_copy(activated_hidden);
+    // A factored model grows the V x r factor; the r x H factor is shared by all words
+    Matrix *output = rnn->output_weights ? rnn->output_weights : rnn->output_left;
+    int fan_in = output->cols;
+    matrix_resize(output, vocab_size, fan_in);
+    fresh = matrix_create(added, fan_in);
+    matrix_xavier_randomize(fresh, fan_in, vocab_size);
+    for (int i = 0; i < added; i++)
+        memcpy(output->entries[old_size + i], fresh->entries[i], fan_in * sizeof(double));
+    matrix_free(fresh);
+
+    // New rows of a pruned model are dense until the next prune
+    if (rnn->output_sparse)
+    {
+        sparse_free(rnn->output_sparse);
+        rnn->output_sparse = sparse_from_matrix(rnn->output_weights);
+    }
+
+    rnn->input_size = vocab_size;
+    rnn->output_size = vocab_size;
+}
+
+// Index of the single 1.0 in a one-hot column vector, -1 for an all-zero
+// vector and -2 for any other input
+static int one_hot_index(const Matrix *input)
+{
+    if (input->cols != 1)
+        return -2;
+    int index = -1;
+    for (int i = 0; i < input->rows; i++)
+    {
+        double x = input->entries[i][0];
+        if (x == 0.0)
+            continue;
+        if (x != 1.0 || index >= 0)
+            return -2;
+        index = i;
+    }
+    return index;
+}
+
+Matrix *rnn_forward(RNN *rnn, Matrix *input)
+{
+    // Update hidden state in place: hidden_state = tanh(hidden_weigths * input + hidden_state)
+    int token = input->rows == rnn->input_size ? one_hot_index(input) : -2;
+    if (token >= -1)
+    {
+        // A one-hot input selects column token of hidden_weights, as in rnn_step_hidden
+        for (int i = 0; i < rnn->hidden_size; i++)
+        {
+            double *hidden = &rnn->hidden_state->entries[i][0];
+            *hidden = tanh((token >= 0 ? rnn->hidden_weights->entries[i][token] : 0.0) + *hidden);
+        }
+    }
+    else
+    {
+        ExprGraph g;
+        expr_graph_init(&g);
+        Expr *hidden_input = expr_dot(&g, expr_matrix(&g, rnn->hidden_weights), expr_matrix(&g, input));
+        Expr *hidden = expr_add(&g, hidden_input, expr_matrix(&g, rnn->hidden_state));
+        expr_assign(rnn->hidden_state, expr_apply(&g, tanh, hidden));
+    }
 
     // Compute output: output = output_weights * hidden_state
-    Matrix *output = matrix_dot(rnn->output_weights, activated_hidden);
-    matrix_free(activated_hidden);
+    return rnn_output_projection(rnn, rnn->hidden_state);
+}
+
+// output_weights * hidden, using the pruned or factored form when present
+Matrix *rnn_output_projection(RNN *rnn, Matrix *hidden)
+{
+    if (rnn->output_sparse)
+        return sparse_dot(rnn->output_sparse, hidden);
+    if (rnn->output_left)
+    {
+        // output_left * (output_right * hidden): O(r * (V + H)) instead of O(V * H)
+        ExprGraph g;
+        expr_graph_init(&g);
+        Expr *projected = expr_dot(&g, expr_matrix(&g, rnn->output_right), expr_matrix(&g, hidden));
+        return expr_eval(expr_dot(&g, expr_matrix(&g, rnn->output_left), projected));
+    }
+    return matrix_dot(rnn->output_weights, hidden);
+}
+
+// Forward-only inference state; holds everything a step writes, so any
+// number of states can run against one shared, unmodified model
+RNNState *rnn_state_create(const RNN *rnn)
+{
+    RNNState *state = (RNNState *)malloc(sizeof(RNNState));
+    int rank = rnn->output_right ? rnn->output_right->rows : 0;
+    if (state)
+    {
+        state->hidden = (double *)calloc(rnn->hidden_size, sizeof(double));
+        state->projected = rank ? (double *)malloc(rank * sizeof(double)) : NULL;
+        state->output = (double *)malloc(rnn->output_size * sizeof(double));
+    }
+    if (!state || !state->hidden || (rank && !state->projected) || !state->output)
+    {
+        fprintf(stderr, "Error: Unable to allocate memory for RNN state\n");
+        exit(EXIT_FAILURE);
+    }
+    return state;
+}
+
+void rnn_state_free(RNNState *state)
+{
+    if (state)
+    {
+        free(state->hidden);
+        free(state->projected);
+        free(state->output);
+        free(state);
+    }
+}
+
+void rnn_state_reset(const RNN *rnn, RNNState *state)
+{
+    memset(state->hidden, 0, rnn->hidden_size * sizeof(double));
+}
 
-    return output;
+// Start from the hidden state saved with the model, as rnn_generate_text does
+void rnn_state_restore(const RNN *rnn, RNNState *state)
+{
+    for (int i = 0; i < rnn->hidden_size; i++)
+        state->hidden[i] = rnn->hidden_state->entries[i][0];
+}
+
+// hidden = tanh(hidden_weights * one_hot(token) + hidden); the product is
+// just column token of hidden_weights
+void rnn_step_hidden(const RNN *rnn, double *hidden, int token)
+{
+    for (int i = 0; i < rnn->hidden_size; i++)
+        hidden[i] = tanh(rnn->hidden_weights->entries[i][token] + hidden[i]);
+}
+
+// Output projection of count hidden states at once, laid out one after another.
+// projected holds count * rank doubles for a factored model and may be NULL otherwise.
+void rnn_project_batch(const RNN *rnn, const double *hidden, int count, double *projected, double *output)
+{
+    if (rnn->output_sparse)
+    {
+        for (int c = 0; c < count; c++)
+            sparse_gemv(rnn->output_sparse, hidden + (size_t)c * rnn->hidden_size, output + (size_t)c * rnn->output_size);
+    }
+    else if (rnn->output_left)
+    {
+        matrix_gemv_batch(rnn->output_right, hidden, count, projected);
+        matrix_gemv_batch(rnn->output_left, projected, count, output);
+    }
+    else
+        matrix_gemv_batch(rnn->output_weights, hidden, count, output);
+}
+
+// Same result as rnn_forward with a one-hot input, without allocating
+const double *rnn_step(const RNN *rnn, RNNState *state, int token)
+{
+    rnn_step_hidden(rnn, state->hidden, token);
+
+    if (rnn->output_sparse)
+        sparse_gemv(rnn->output_sparse, state->hidden, state->output);
+    else if (rnn->output_left)
+    {
+        matrix_gemv(rnn->output_right, state->hidden, state->projected);
+        matrix_gemv(rnn->output_left, state->projected, state->output);
+    }
+    else
+        matrix_gemv(rnn->output_weights, state->hidden, state->output);
+    return state->output;
+}
+
+// Same tie-breaking as matrix_argmax, so all generation paths agree
+int rnn_output_argmax(const RNN *rnn, const double *output)
+{
+    double max_score = 0.0;
+    int best = 0;
+    for (int i = 0; i < rnn->output_size; i++)
+    {
+        if (output[i] > max_score)
+        {
+            max_score = output[i];
+            best = i;
+        }
+    }
+    return best;
+}
+
+int rnn_state_argmax(const RNN *rnn, const RNNState *state)
+{
+    return rnn_output_argmax(rnn, state->output);
+}
+
+// Greedy generation: step on token, append the argmax to out and feed it back, length times
+void rnn_generate_tokens(const RNN *rnn, RNNState *state, int token, int length, int *out)
+{
+    for (int i = 0; i < length; i++)
+    {
+        rnn_step(rnn, state, token);
+        token = rnn_state_argmax(rnn, state);
+        out[i] = token;
+    }
 }
 
 double square(double x)
@@ -76,56 +299,509 @@ double square(double x)
     return x * x;
 }
 
-void rnn_backward(RNN *rnn, Matrix *input, Matrix *target)
+// Matrices holding trainable weights, in flat buffer order. Only one of
+// output_weights and the output_left/output_right pair is present.
+#define NUM_TRAINABLE 4
+
+static void trainable_weights(RNN *rnn, Matrix **matrices)
+{
+    matrices[0] = rnn->hidden_weights;
+    matrices[1] = rnn->output_weights;
+    matrices[2] = rnn->output_left;
+    matrices[3] = rnn->output_right;
+}
+
+static void gradient_matrices(RNNGradients *grads, Matrix **matrices)
+{
+    matrices[0] = grads->hidden_weights;
+    matrices[1] = grads->output_weights;
+    matrices[2] = grads->output_left;
+    matrices[3] = grads->output_right;
+}
+
+static Matrix *zero_like(Matrix *m)
+{
+    return m ? matrix_zero(m->rows, m->cols) : NULL;
+}
+
+RNNGradients *rnn_gradients_create(RNN *rnn)
+{
+    RNNGradients *grads = (RNNGradients *)malloc(sizeof(RNNGradients));
+    if (!grads)
+    {
+        fprintf(stderr, "Error: Unable to allocate memory for RNN gradients\n");
+        exit(EXIT_FAILURE);
+    }
+    MatrixMemoryClass memory_class = matrix_memory_set_class(MATRIX_MEMORY_GRADIENTS);
+    grads->hidden_weights = zero_like(rnn->hidden_weights);
+    grads->output_weights = zero_like(rnn->output_weights);
+    grads->output_left = zero_like(rnn->output_left);
+    grads->output_right = zero_like(rnn->output_right);
+    matrix_memory_set_class(memory_class);
+    return grads;
+}
+
+void rnn_gradients_free(RNNGradients *grads)
+{
+    if (grads)
+    {
+        matrix_free(grads->hidden_weights);
+        matrix_free(grads->output_weights);
+        matrix_free(grads->output_left);
+        matrix_free(grads->output_right);
+        free(grads);
+    }
+}
+
+void rnn_gradients_zero(RNNGradients *grads)
+{
+    Matrix *matrices[NUM_TRAINABLE];
+    gradient_matrices(grads, matrices);
+    for (int k = 0; k < NUM_TRAINABLE; k++)
+    {
+        if (matrices[k])
+            matrix_fill(matrices[k], 0.0);
+    }
+}
+
+static size_t matrices_size(Matrix **matrices, int count)
+{
+    size_t size = 0;
+    for (int k = 0; k < count; k++)
+    {
+        if (matrices[k])
+            size += (size_t)matrices[k]->rows * matrices[k]->cols;
+    }
+    return size;
+}
+
+// Copy matrices to (pack) or from (unpack) a flat buffer, e.g. for an all-reduce
+static void matrices_transfer(Matrix **matrices, int count, double *buffer, int pack)
+{
+    for (int k = 0; k < count; k++)
+    {
+        Matrix *m = matrices[k];
+        for (int i = 0; m && i < m->rows; i++)
+        {
+            if (pack)
+                memcpy(buffer, m->entries[i], m->cols * sizeof(double));
+            else
+                memcpy(m->entries[i], buffer, m->cols * sizeof(double));
+            buffer += m->cols;
+        }
+    }
+}
+
+// Number of doubles needed to hold all gradients in one flat buffer
+size_t rnn_gradients_size(RNNGradients *grads)
+{
+    Matrix *matrices[NUM_TRAINABLE];
+    gradient_matrices(grads, matrices);
+    return matrices_size(matrices, NUM_TRAINABLE);
+}
+
+void rnn_gradients_pack(RNNGradients *grads, double *buffer)
+{
+    Matrix *matrices[NUM_TRAINABLE];
+    gradient_matrices(grads, matrices);
+    matrices_transfer(matrices, NUM_TRAINABLE, buffer, 1);
+}
+
+void rnn_gradients_unpack(RNNGradients *grads, const double *buffer)
+{
+    Matrix *matrices[NUM_TRAINABLE];
+    gradient_matrices(grads, matrices);
+    matrices_transfer(matrices, NUM_TRAINABLE, (double *)buffer, 0);
+}
+
+// Weights use the same flat layout as the gradients
+size_t rnn_parameter_count(RNN *rnn)
+{
+    Matrix *matrices[NUM_TRAINABLE];
+    trainable_weights(rnn, matrices);
+    return matrices_size(matrices, NUM_TRAINABLE);
+}
+
+void rnn_parameters_pack(RNN *rnn, double *buffer)
+{
+    Matrix *matrices[NUM_TRAINABLE];
+    trainable_weights(rnn, matrices);
+    matrices_transfer(matrices, NUM_TRAINABLE, buffer, 1);
+}
+
+void rnn_parameters_unpack(RNN *rnn, const double *buffer)
+{
+    Matrix *matrices[NUM_TRAINABLE];
+    trainable_weights(rnn, matrices);
+    matrices_transfer(matrices, NUM_TRAINABLE, (double *)buffer, 0);
+}
+
+// gradient += a * b^T, a rank-one update in place
+static void accumulate_outer(Matrix *gradient, Matrix *a, Matrix *b)
+{
+    ExprGraph g;
+    expr_graph_init(&g);
+    Expr *outer = expr_dot(&g, expr_matrix(&g, a), expr_transpose(&g, expr_matrix(&g, b)));
+    expr_assign(gradient, expr_add(&g, expr_matrix(&g, gradient), outer));
+}
+
+// m^T * v, reading m in place
+static Matrix *transpose_dot(Matrix *m, Matrix *v)
+{
+    ExprGraph g;
+    expr_graph_init(&g);
+    return expr_eval(expr_dot(&g, expr_transpose(&g, expr_matrix(&g, m)), expr_matrix(&g, v)));
+}
+
+// Add the gradients for one (input, target) pair to grads without touching
+// the weights; returns the mean square error of the forward pass
+double rnn_accumulate_gradients(RNN *rnn, Matrix *input, Matrix *target, RNNGradients *grads)
 {
     // Perform forward pass to get the output and hidden state
     Matrix *output = rnn_forward(rnn, input);
+    double loss = matrix_mean_square_error(output, target);
 
-    // Compute the error in the output layer: output_error = output - target
-    Matrix *output_error = matrix_subtract(output, target);
+    // Compute the error in the output layer in place: output_error = output - target
+    ExprGraph g;
+    expr_graph_init(&g);
+    Matrix *output_error = output;
+    expr_assign(output_error, expr_subtract(&g, expr_matrix(&g, output), expr_matrix(&g, target)));
 
-    // Compute the gradient of the loss with respect to the output weights
-    // output_weights_gradient = output_error * hidden_state^T
-    Matrix *hidden_state_transpose = matrix_transpose(rnn->hidden_state);
-    Matrix *output_weights_gradient = matrix_dot(output_error, hidden_state_transpose);
-    matrix_free(hidden_state_transpose);
+    // Compute the gradient of the loss with respect to the hidden state
+    Matrix *hidden_error;
+    if (rnn->output_left)
+    {
+        // Factored output: output = output_left * projected, projected = output_right * hidden_state
+        Matrix *projected = matrix_dot(rnn->output_right, rnn->hidden_state);
 
-    // Update the output weights: output_weights -= learning_rate * output_weights_gradient
-    Matrix *scaled_output_weights_gradient = matrix_scale(rnn->learning_rate, output_weights_gradient);
-    Matrix *updated_output_weights = matrix_subtract(rnn->output_weights, scaled_output_weights_gradient);
-    matrix_free(rnn->output_weights);
-    rnn->output_weights = updated_output_weights;
-    matrix_free(scaled_output_weights_gradient);
-    matrix_free(output_weights_gradient);
+        // output_left_gradient += output_error * projected^T
+        accumulate_outer(grads->output_left, output_error, projected);
+        matrix_free(projected);
 
-    // Compute the gradient of the loss with respect to the hidden state
-    // hidden_error = output_weights^T * output_error
-    Matrix *output_weights_transpose = matrix_transpose(rnn->output_weights);
-    Matrix *hidden_error = matrix_dot(output_weights_transpose, output_error);
-    matrix_free(output_weights_transpose);
+        // projected_error = output_left^T * output_error
+        Matrix *projected_error = transpose_dot(rnn->output_left, output_error);
+
+        // output_right_gradient += projected_error * hidden_state^T
+        accumulate_outer(grads->output_right, projected_error, rnn->hidden_state);
+
+        // hidden_error = output_right^T * projected_error
+        hidden_error = transpose_dot(rnn->output_right, projected_error);
+        matrix_free(projected_error);
+    }
+    else
+    {
+        // output_weights_gradient += output_error * hidden_state^T
+        accumulate_outer(grads->output_weights, output_error, rnn->hidden_state);
+
+        // hidden_error = output_weights^T * output_error
+        hidden_error = transpose_dot(rnn->output_weights, output_error);
+    }
 
     // Compute the gradient of the loss with respect to the hidden weights
-    // hidden_weights_gradient = hidden_error * input^T
-    Matrix *input_transpose = matrix_transpose(input);
-    Matrix *hidden_weights_gradient = matrix_dot(hidden_error, input_transpose);
-    matrix_free(input_transpose);
-
-    // Update the hidden weights: hidden_weights -= learning_rate * hidden_weights_gradient
-    Matrix *scaled_hidden_weights_gradient = matrix_scale(rnn->learning_rate, hidden_weights_gradient);
-    Matrix *updated_hidden_weights = matrix_subtract(rnn->hidden_weights, scaled_hidden_weights_gradient);
-    matrix_free(rnn->hidden_weights);
-    rnn->hidden_weights = updated_hidden_weights;
-    matrix_free(scaled_hidden_weights_gradient);
-    matrix_free(hidden_weights_gradient);
+    // hidden_weights_gradient += hidden_error * input^T
+    accumulate_outer(grads->hidden_weights, hidden_error, input);
 
     // Update the hidden state for the next iteration
-    matrix_free(rnn->hidden_state);
-    rnn->hidden_state = matrix_copy(hidden_error);
+    expr_graph_init(&g);
+    expr_assign(rnn->hidden_state, expr_matrix(&g, hidden_error));
 
     // Free memory
-    matrix_free(output);
     matrix_free(output_error);
     matrix_free(hidden_error);
+
+    return loss;
+}
+
+// weights -= rate * gradient, one axpy pass in place; weights keep the
+// spare capacity left by rnn_grow_vocabulary
+static void apply_update(Matrix *weights, Matrix *gradient, double rate)
+{
+    ExprGraph g;
+    expr_graph_init(&g);
+    Expr *step = expr_scale(&g, rate, expr_matrix(&g, gradient));
+    expr_assign(weights, expr_subtract(&g, expr_matrix(&g, weights), step));
+}
+
+// weights -= learning_rate * scale * gradients
+void rnn_apply_gradients(RNN *rnn, RNNGradients *grads, double scale)
+{
+    double rate = rnn->learning_rate * scale;
+    if (rnn->output_left)
+    {
+        apply_update(rnn->output_left, grads->output_left, rate);
+        apply_update(rnn->output_right, grads->output_right, rate);
+    }
+    else
+    {
+        apply_update(rnn->output_weights, grads->output_weights, rate);
+    }
+    apply_update(rnn->hidden_weights, grads->hidden_weights, rate);
+
+    // Fine-tuning a pruned model: keep pruned weights at zero
+    if (rnn->output_sparse)
+        sparse_refresh_values(rnn->output_sparse, rnn->output_weights);
+}
+
+// weights -= rate * a * b^T in one pass over weights, without storing the gradient
+static void update_outer(Matrix *weights, Matrix *a, Matrix *b, double rate)
+{
+    ExprGraph g;
+    expr_graph_init(&g);
+    Expr *outer = expr_dot(&g, expr_matrix(&g, a), expr_transpose(&g, expr_matrix(&g, b)));
+    expr_assign(weights, expr_subtract(&g, expr_matrix(&g, weights), expr_scale(&g, rate, outer)));
+}
+
+// One SGD step on (input, target), updating the weights in place one layer
+// at a time from the output down, so each layer's error is propagated
+// through the weights already updated above it; returns the mean square
+// error of the forward pass
+double rnn_backward(RNN *rnn, Matrix *input, Matrix *target)
+{
+    // Perform forward pass to get the output and hidden state
+    Matrix *output = rnn_forward(rnn, input);
+    double loss = matrix_mean_square_error(output, target);
+
+    // Compute the error in the output layer in place: output_error = output - target
+    ExprGraph g;
+    expr_graph_init(&g);
+    Matrix *output_error = output;
+    expr_assign(output_error, expr_subtract(&g, expr_matrix(&g, output), expr_matrix(&g, target)));
+
+    double rate = rnn->learning_rate;
+    Matrix *hidden_error;
+    if (rnn->output_left)
+    {
+        // Factored output: output = output_left * projected, projected = output_right * hidden_state
+        Matrix *projected = matrix_dot(rnn->output_right, rnn->hidden_state);
+
+        // output_left -= learning_rate * output_error * projected^T
+        update_outer(rnn->output_left, output_error, projected, rate);
+        matrix_free(projected);
+
+        // projected_error = output_left^T * output_error
+        Matrix *projected_error = transpose_dot(rnn->output_left, output_error);
+
+        // output_right -= learning_rate * projected_error * hidden_state^T
+        update_outer(rnn->output_right, projected_error, rnn->hidden_state, rate);
+
+        // hidden_error = output_right^T * projected_error
+        hidden_error = transpose_dot(rnn->output_right, projected_error);
+        matrix_free(projected_error);
+    }
+    else
+    {
+        // output_weights -= learning_rate * output_error * hidden_state^T
+        update_outer(rnn->output_weights, output_error, rnn->hidden_state, rate);
+
+        // hidden_error = output_weights^T * output_error, with the updated weights
+        hidden_error = transpose_dot(rnn->output_weights, output_error);
+    }
+
+    // hidden_weights -= learning_rate * hidden_error * input^T
+    update_outer(rnn->hidden_weights, hidden_error, input, rate);
+
+    // Fine-tuning a pruned model: keep pruned weights at zero
+    if (rnn->output_sparse)
+        sparse_refresh_values(rnn->output_sparse, rnn->output_weights);
+
+    // Update the hidden state for the next iteration
+    expr_graph_init(&g);
+    expr_assign(rnn->hidden_state, expr_matrix(&g, hidden_error));
+
+    // Free memory
+    matrix_free(output_error);
+    matrix_free(hidden_error);
+
+    return loss;
+}
+
+static double *bptt_alloc(size_t count)
+{
+    if (count == 0)
+        return NULL;
+    double *buffer = (double *)malloc(count * sizeof(double));
+    if (!buffer)
+    {
+        fprintf(stderr, "Error: Unable to allocate memory for BPTT\n");
+        exit(EXIT_FAILURE);
+    }
+    return buffer;
+}
+
+// checkpoint_every 0 picks ceil(sqrt(seq_len)), which minimizes stored activations
+RNNBptt *rnn_bptt_create(const RNN *rnn, int seq_len, int checkpoint_every)
+{
+    RNNBptt *bptt = (RNNBptt *)malloc(sizeof(RNNBptt));
+    if (!bptt)
+    {
+        fprintf(stderr, "Error: Unable to allocate memory for BPTT\n");
+        exit(EXIT_FAILURE);
+    }
+    if (checkpoint_every <= 0)
+        checkpoint_every = (int)ceil(sqrt((double)seq_len));
+    if (checkpoint_every > seq_len)
+        checkpoint_every = seq_len;
+
+    int rank = rnn->output_right ? rnn->output_right->rows : 0;
+    bptt->seq_len = seq_len;
+    bptt->checkpoint_every = checkpoint_every;
+    bptt->num_checkpoints = (seq_len + checkpoint_every - 1) / checkpoint_every;
+    bptt->checkpoints = bptt_alloc((size_t)bptt->num_checkpoints * rnn->hidden_size);
+    bptt->segment = bptt_alloc((size_t)(checkpoint_every - 1) * rnn->hidden_size);
+    bptt->hidden = bptt_alloc(rnn->hidden_size);
+    bptt->hidden_error = bptt_alloc(rnn->hidden_size);
+    bptt->output = bptt_alloc(rnn->output_size);
+    bptt->projected = bptt_alloc(rank);
+    bptt->projected_error = bptt_alloc(rank);
+    bptt->recomputed_steps = 0;
+    return bptt;
+}
+
+void rnn_bptt_free(RNNBptt *bptt)
+{
+    if (bptt)
+    {
+        free(bptt->checkpoints);
+        free(bptt->segment);
+        free(bptt->hidden);
+        free(bptt->hidden_error);
+        free(bptt->output);
+        free(bptt->projected);
+        free(bptt->projected_error);
+        free(bptt);
+    }
+}
+
+// Hidden states kept for the backward pass: the checkpoints plus one segment
+size_t rnn_bptt_activation_bytes(const RNN *rnn, const RNNBptt *bptt)
+{
+    return (size_t)(bptt->num_checkpoints + bptt->checkpoint_every - 1) * rnn->hidden_size * sizeof(double);
+}
+
+// Backward through one step given the hidden state after it. On entry
+// hidden_error holds the gradient from the following step; on return it holds
+// the gradient for the previous one. Returns the step's mean square error.
+static double bptt_step_backward(const RNN *rnn, RNNBptt *bptt, const double *hidden, uint32_t input,
+                                 uint32_t target, RNNGradients *grads)
+{
+    int hidden_size = rnn->hidden_size;
+    double *output_error = bptt->output;
+    double *hidden_error = bptt->hidden_error;
+
+    rnn_project_batch(rnn, hidden, 1, bptt->projected, output_error);
+    output_error[target] -= 1.0;
+    double loss = 0.0;
+    for (int i = 0; i < rnn->output_size; i++)
+        loss += output_error[i] * output_error[i];
+
+    if (rnn->output_left)
+    {
+        int rank = rnn->output_right->rows;
+        double *projected_error = bptt->projected_error;
+        memset(projected_error, 0, rank * sizeof(double));
+        for (int i = 0; i < rnn->output_size; i++)
+        {
+            double e = output_error[i];
+            const double *left = rnn->output_left->entries[i];
+            double *gradient = grads->output_left->entries[i];
+            for (int r = 0; r < rank; r++)
+            {
+                gradient[r] += e * bptt->projected[r];
+                projected_error[r] += e * left[r];
+            }
+        }
+        for (int r = 0; r < rank; r++)
+        {
+            double e = projected_error[r];
+            const double *right = rnn->output_right->entries[r];
+            double *gradient = grads->output_right->entries[r];
+            for (int j = 0; j < hidden_size; j++)
+            {
+                gradient[j] += e * hidden[j];
+                hidden_error[j] += e * right[j];
+            }
+        }
+    }
+    else
+    {
+        // Output gradient and output_weights^T * error in one pass over the weights
+        for (int i = 0; i < rnn->output_size; i++)
+        {
+            double e = output_error[i];
+            const double *weights = rnn->output_weights->entries[i];
+            double *gradient = grads->output_weights->entries[i];
+            for (int j = 0; j < hidden_size; j++)
+            {
+                gradient[j] += e * hidden[j];
+                hidden_error[j] += e * weights[j];
+            }
+        }
+    }
+
+    // Through tanh. The input is one-hot, so only one column of hidden_weights
+    // has a gradient, and the recurrence is the identity, so the result is
+    // also the error carried to the previous step.
+    for (int j = 0; j < hidden_size; j++)
+    {
+        hidden_error[j] *= 1.0 - hidden[j] * hidden[j];
+        grads->hidden_weights->entries[j][input] += hidden_error[j];
+    }
+    return loss / rnn->output_size;
+}
+
+// Add the gradients of one window of seq_len (input, target) pairs, starting
+// from a zero hidden state. The forward pass keeps the hidden state at the end
+// of every segment of checkpoint_every steps; the backward pass walks the
+// segments last to first, recomputing each one's states from the end of the
+// previous segment. Returns the summed mean square error of the window.
+double rnn_bptt_accumulate(RNN *rnn, RNNBptt *bptt, const uint32_t *inputs, const uint32_t *targets,
+                           RNNGradients *grads)
+{
+    int hidden_size = rnn->hidden_size;
+    int every = bptt->checkpoint_every;
+    size_t row = hidden_size * sizeof(double);
+    double *hidden = bptt->hidden;
+
+    memset(hidden, 0, row);
+    for (int t = 0; t < bptt->seq_len; t++)
+    {
+        rnn_step_hidden(rnn, hidden, inputs[t]);
+        if ((t + 1) % every == 0 || t == bptt->seq_len - 1)
+            memcpy(bptt->checkpoints + (size_t)(t / every) * hidden_size, hidden, row);
+    }
+    // Leave the final state in the model, as the single-step trainer does
+    for (int j = 0; j < hidden_size; j++)
+        rnn->hidden_state->entries[j][0] = hidden[j];
+
+    double loss = 0.0;
+    memset(bptt->hidden_error, 0, row);
+    for (int s = bptt->num_checkpoints - 1; s >= 0; s--)
+    {
+        int first = s * every;
+        int length = bptt->seq_len - first < every ? bptt->seq_len - first : every;
+
+        // Recompute all but the last state of the segment, which is the checkpoint
+        const double *previous = s > 0 ? bptt->checkpoints + (size_t)(s - 1) * hidden_size : NULL;
+        for (int j = 0; j < length - 1; j++)
+        {
+            double *state = bptt->segment + (size_t)j * hidden_size;
+            if (previous)
+                memcpy(state, previous, row);
+            else
+                memset(state, 0, row);
+            rnn_step_hidden(rnn, state, inputs[first + j]);
+            previous = state;
+        }
+        bptt->recomputed_steps += length - 1;
+
+        for (int j = length - 1; j >= 0; j--)
+        {
+            const double *state = j == length - 1 ? bptt->checkpoints + (size_t)s * hidden_size
+                                                  : bptt->segment + (size_t)j * hidden_size;
+            loss += bptt_step_backward(rnn, bptt, state, inputs[first + j], targets[first + j], grads);
+        }
+    }
+    return loss;
 }
 
 // Generate text using the RNN
@@ -203,11 +879,32 @@ void rnn_save(RNN *rnn, const char *filename)
     fwrite(&rnn->output_size, sizeof(int), 1, file);
     fwrite(&rnn->learning_rate, sizeof(double), 1, file);
 
-    // Save matrices
+    // Save matrices; a factored or pruned model stores an empty output_weights
     matrix_save(rnn->hidden_weights, file);
-    matrix_save(rnn->output_weights, file);
+    if (rnn->output_weights && !rnn->output_sparse)
+        matrix_save(rnn->output_weights, file);
+    else
+        fprintf(file, "0\n0\n");
     matrix_save(rnn->hidden_state, file);
 
+    // Optional sections, each introduced by its name on a line of its own
+    if (rnn->output_sparse && rnn->output_block_cols > 1)
+    {
+        fprintf(file, "block_sparse_output\n");
+        sparse_save_blocks(rnn->output_sparse, rnn->output_block_cols, file);
+    }
+    else if (rnn->output_sparse)
+    {
+        fprintf(file, "sparse_output\n");
+        sparse_save(rnn->output_sparse, file);
+    }
+    if (rnn->output_left)
+    {
+        fprintf(file, "lowrank_output\n");
+        matrix_save(rnn->output_left, file);
+        matrix_save(rnn->output_right, file);
+    }
+
     fclose(file);
 }
 
@@ -221,25 +918,274 @@ RNN *rnn_load(const char *filename)
         exit(EXIT_FAILURE);
     }
 
+    RNN *rnn = (RNN *)malloc(sizeof(RNN));
+    if (!rnn)
+    {
+        fprintf(stderr, "Error: Unable to allocate memory for RNN\n");
+        exit(EXIT_FAILURE);
+    }
+
     // Load RNN metadata
-    int input_size, hidden_size, output_size;
-    double learning_rate;
-    fread(&input_size, sizeof(int), 1, file);
-    fread(&hidden_size, sizeof(int), 1, file);
-    fread(&output_size, sizeof(int), 1, file);
-    fread(&learning_rate, sizeof(double), 1, file);
-
-    // Initialize RNN
-    RNN *rnn = rnn_init(input_size, hidden_size, output_size, learning_rate);
-
-    // Load matrices
-    matrix_free(rnn->hidden_weights);
-    matrix_free(rnn->output_weights);
-    matrix_free(rnn->hidden_state);
-    rnn->hidden_weights = matrix_load(file);
-    rnn->output_weights = matrix_load(file);
-    rnn->hidden_state = matrix_load(file);
+    int ok = fread(&rnn->input_size, sizeof(int), 1, file) == 1 &&
+             fread(&rnn->hidden_size, sizeof(int), 1, file) == 1 &&
+             fread(&rnn->output_size, sizeof(int), 1, file) == 1 &&
+             fread(&rnn->learning_rate, sizeof(double), 1, file) == 1;
 
+    // Load matrices straight into the model instead of replacing freshly initialized ones
+    MatrixMemoryClass memory_class = matrix_memory_set_class(MATRIX_MEMORY_WEIGHTS);
+    rnn->hidden_weights = ok ? matrix_load(file) : NULL;
+    rnn->output_weights = rnn->hidden_weights ? matrix_load(file) : NULL;
+    rnn->hidden_state = rnn->output_weights ? matrix_load(file) : NULL;
+    rnn->output_sparse = NULL;
+    rnn->output_block_cols = 1;
+    rnn->output_left = NULL;
+    rnn->output_right = NULL;
+    if (rnn->output_weights && rnn->output_weights->rows == 0)
+    {
+        // Factored or pruned model, the output projection follows in its own section
+        matrix_free(rnn->output_weights);
+        rnn->output_weights = NULL;
+    }
+
+    // Optional sections; files from older versions end here
+    char section[MAX_SECTION_NAME];
+    while (rnn->hidden_state && fgets(section, sizeof(section), file))
+    {
+        int valid = 0;
+        // Older pruned files also kept the dense output_weights, dropped below
+        if (strcmp(section, "sparse_output\n") == 0 && !rnn->output_sparse)
+        {
+            rnn->output_sparse = sparse_load(file);
+            valid = rnn->output_sparse && !rnn->output_left && rnn->output_sparse->rows == rnn->output_size &&
+                    rnn->output_sparse->cols == rnn->hidden_size;
+        }
+        else if (strcmp(section, "block_sparse_output\n") == 0 && !rnn->output_sparse)
+        {
+            rnn->output_sparse = sparse_load_blocks(file, &rnn->output_block_cols);
+            valid = rnn->output_sparse && !rnn->output_left && rnn->output_sparse->rows == rnn->output_size &&
+                    rnn->output_sparse->cols == rnn->hidden_size;
+        }
+        else if (strcmp(section, "lowrank_output\n") == 0 && !rnn->output_left)
+        {
+            rnn->output_left = matrix_load(file);
+            rnn->output_right = rnn->output_left ? matrix_load(file) : NULL;
+            valid = rnn->output_right && !rnn->output_weights && !rnn->output_sparse && rnn->output_left->rows == rnn->output_size &&
+                    rnn->output_left->cols == rnn->output_right->rows && rnn->output_right->cols == rnn->hidden_size;
+        }
+        if (!valid)
+        {
+            fprintf(stderr, "Error: %s has an invalid section %s", filename, section);
+            rnn_free(rnn);
+            exit(EXIT_FAILURE);
+        }
+    }
     fclose(file);
+    matrix_memory_set_class(memory_class);
+
+    // A pruned model keeps only the CSR form; see rnn_densify_output
+    if (rnn->output_sparse && rnn->output_weights)
+    {
+        matrix_free(rnn->output_weights);
+        rnn->output_weights = NULL;
+    }
+
+    if (!rnn->hidden_state || (!rnn->output_weights && !rnn->output_left && !rnn->output_sparse))
+    {
+        fprintf(stderr, "Error: %s is truncated or not an RNN model\n", filename);
+        rnn_free(rnn);
+        exit(EXIT_FAILURE);
+    }
     return rnn;
-}
\ No newline at end of file
+}
+
+void rnn_memory_usage(RNN *rnn, RNNMemoryUsage *usage)
+{
+    Matrix *matrices[NUM_TRAINABLE];
+    trainable_weights(rnn, matrices);
+    usage->weight_bytes = 0;
+    for (int k = 0; k < NUM_TRAINABLE; k++)
+    {
+        if (matrices[k])
+            usage->weight_bytes += matrix_memory_bytes(matrices[k]);
+    }
+    usage->weight_bytes += matrix_memory_bytes(rnn->hidden_state);
+    if (rnn->output_sparse)
+        usage->weight_bytes += sparse_memory_bytes(rnn->output_sparse);
+
+    // Gradient sets and workspace matrices are counted as they are allocated
+    usage->gradient_bytes = matrix_memory_class_peak_bytes(MATRIX_MEMORY_GRADIENTS);
+    usage->workspace_bytes = matrix_memory_class_peak_bytes(MATRIX_MEMORY_WORKSPACE);
+
+    struct rusage ru;
+    usage->peak_rss_kb = getrusage(RUSAGE_SELF, &ru) == 0 ? ru.ru_maxrss : -1;
+}
+
+void rnn_memory_report(RNN *rnn, FILE *out, const char *label)
+{
+    RNNMemoryUsage usage;
+    rnn_memory_usage(rnn, &usage);
+    fprintf(out, "[memory] %s: weights %.1f KiB, gradients %.1f KiB, workspace %.1f KiB, peak RSS %ld KiB\n",
+            label, usage.weight_bytes / 1024.0, usage.gradient_bytes / 1024.0,
+            usage.workspace_bytes / 1024.0, usage.peak_rss_kb);
+#ifdef MATRIX_TRACK_ALLOCATIONS
+    matrix_memory_report(out, label);
+#endif
+}
+
+// Prune output_weights to the given sparsity (whole runs of block_cols
+// columns when block_cols > 1) and switch the output projection to CSR.
+// Returns the sparsity reached.
+double rnn_prune_output(RNN *rnn, double sparsity, int block_cols)
+{
+    rnn_densify_output(rnn);
+    if (!rnn->output_weights)
+    {
+        fprintf(stderr, "Error: Cannot prune a factored output projection\n");
+        return 0.0;
+    }
+    double reached = matrix_prune_blocks(rnn->output_weights, block_cols, sparsity);
+    sparse_free(rnn->output_sparse);
+    rnn->output_sparse = sparse_from_matrix(rnn->output_weights);
+    rnn->output_block_cols = block_cols > 1 ? block_cols : 1;
+    return reached;
+}
+
+// Replace output_weights (V x H) by output_left (V x r) * output_right (r x H)
+// from its truncated SVD, with the smallest rank that keeps the given fraction
+// of the squared singular values (capped at max_rank when positive). Returns
+// the rank; *retained receives the energy fraction kept.
+int rnn_factorize_output(RNN *rnn, double energy, int max_rank, double *retained)
+{
+    rnn_densify_output(rnn);
+    if (!rnn->output_weights)
+    {
+        fprintf(stderr, "Error: Output projection is already factored\n");
+        return 0;
+    }
+
+    // Right singular vectors are the eigenvectors of W^T W, with eigenvalues sigma^2
+    int h = rnn->hidden_size;
+    Matrix *gram = transpose_dot(rnn->output_weights, rnn->output_weights);
+    Matrix *vectors = matrix_create(h, h);
+    double *values = (double *)malloc(h * sizeof(double));
+    if (!values)
+    {
+        fprintf(stderr, "Error: Unable to allocate memory for factorization\n");
+        exit(EXIT_FAILURE);
+    }
+    matrix_symmetric_eigen(gram, values, vectors);
+    matrix_free(gram);
+
+    double total = 0.0;
+    for (int i = 0; i < h; i++)
+        total += values[i] > 0.0 ? values[i] : 0.0;
+
+    int rank = 0;
+    double kept = 0.0;
+    int limit = max_rank > 0 && max_rank < h ? max_rank : h;
+    while (rank < limit && (total == 0.0 || kept < energy * total))
+    {
+        kept += values[rank] > 0.0 ? values[rank] : 0.0;
+        rank++;
+    }
+    if (rank == 0)
+        rank = 1;
+    free(values);
+
+    // W ~= (W V_r) V_r^T
+    rnn->output_right = matrix_create(rank, h);
+    for (int i = 0; i < rank; i++)
+    {
+        for (int j = 0; j < h; j++)
+            rnn->output_right->entries[i][j] = vectors->entries[j][i];
+    }
+    matrix_free(vectors);
+    ExprGraph g;
+    expr_graph_init(&g);
+    Expr *right_transpose = expr_transpose(&g, expr_matrix(&g, rnn->output_right));
+    rnn->output_left = expr_eval(expr_dot(&g, expr_matrix(&g, rnn->output_weights), right_transpose));
+    matrix_memory_classify(rnn->output_right, MATRIX_MEMORY_WEIGHTS);
+    matrix_memory_classify(rnn->output_left, MATRIX_MEMORY_WEIGHTS);
+
+    matrix_free(rnn->output_weights);
+    rnn->output_weights = NULL;
+    sparse_free(rnn->output_sparse);
+    rnn->output_sparse = NULL;
+
+    if (retained)
+        *retained = total > 0.0 ? kept / total : 1.0;
+    return rank;
+}
+
+// Train the output projection directly in factored form with the given rank
+void rnn_use_low_rank_output(RNN *rnn, int rank)
+{
+    matrix_free(rnn->output_weights);
+    rnn->output_weights = NULL;
+    sparse_free(rnn->output_sparse);
+    rnn->output_sparse = NULL;
+    matrix_free(rnn->output_left);
+    matrix_free(rnn->output_right);
+
+    MatrixMemoryClass memory_class = matrix_memory_set_class(MATRIX_MEMORY_WEIGHTS);
+    rnn->output_left = matrix_create(rnn->output_size, rank);
+    matrix_xavier_randomize(rnn->output_left, rank, rnn->output_size);
+    rnn->output_right = matrix_create(rank, rnn->hidden_size);
+    matrix_xavier_randomize(rnn->output_right, rnn->hidden_size, rank);
+    matrix_memory_set_class(memory_class);
+}
+
+static int add_shape(MatrixShape *shapes, int count, int max_shapes, int rows, int inner, int cols)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (shapes[i].rows == rows && shapes[i].inner == inner && shapes[i].cols == cols)
+            return count;
+    }
+    if (count < max_shapes)
+        shapes[count++] = (MatrixShape){rows, inner, cols};
+    return count;
+}
+
+// Products rnn_forward, rnn_step and rnn_accumulate_gradients perform, one
+// column per sample, plus the groups of MATRIX_BATCH_GROUP hidden states
+// rnn_project_batch projects for speculative decoding
+int rnn_kernel_shapes(const RNN *rnn, MatrixShape *shapes, int max_shapes)
+{
+    int h = rnn->hidden_size, v = rnn->input_size, o = rnn->output_size;
+    int count = 0;
+    count = add_shape(shapes, count, max_shapes, h, v, 1); // hidden_weights * input
+    count = add_shape(shapes, count, max_shapes, h, 1, v); // hidden_error * input^T
+    if (rnn->output_left)
+    {
+        int r = rnn->output_left->cols;
+        count = add_shape(shapes, count, max_shapes, r, h, 1); // output_right * hidden
+        count = add_shape(shapes, count, max_shapes, o, r, 1); // output_left * projected
+        count = add_shape(shapes, count, max_shapes, o, 1, r); // output_error * projected^T
+        count = add_shape(shapes, count, max_shapes, r, o, 1); // output_left^T * output_error
+        count = add_shape(shapes, count, max_shapes, r, 1, h); // projected_error * hidden^T
+        count = add_shape(shapes, count, max_shapes, h, r, 1); // output_right^T * projected_error
+        count = add_shape(shapes, count, max_shapes, r, h, MATRIX_BATCH_GROUP); // output_right * hidden batch
+        count = add_shape(shapes, count, max_shapes, o, r, MATRIX_BATCH_GROUP); // output_left * projected batch
+    }
+    else
+    {
+        count = add_shape(shapes, count, max_shapes, o, h, 1); // output_weights * hidden
+        count = add_shape(shapes, count, max_shapes, o, 1, h); // output_error * hidden^T
+        count = add_shape(shapes, count, max_shapes, h, o, 1); // output_weights^T * output_error
+        if (!rnn->output_sparse)
+            count = add_shape(shapes, count, max_shapes, o, h, MATRIX_BATCH_GROUP); // output_weights * hidden batch
+    }
+    return count;
+}
+
+// Load or benchmark kernels for this model's shapes; see autotune_kernels
+int rnn_autotune(const RNN *rnn, FILE *log)
+{
+    const char *cache_path = autotune_cache_path();
+    if (!cache_path)
+        return 0;
+    MatrixShape shapes[16];
+    int count = rnn_kernel_shapes(rnn, shapes, 16);
+    return autotune_kernels(shapes, count, cache_path, log);
+}
@@ -1,23 +1,120 @@
 #pragma once
-#pragma once
+#include <stddef.h>
+#include <stdint.h>
 #include "../matrix/matrix.h"
+#include "../matrix/sparse.h"
 #include "../vocabulary/vocabulary.h"
 
 typedef struct
 {
-    int input_size;         // Size of the input vector (e.g., vocabulary size)
-    int hidden_size;        // Size of the hidden state vector
-    int output_size;        // Size of the output vector (e.g., vocabulary size)
-    double learning_rate;   // Learning rate for training
-    Matrix *hidden_weights; // Weights for the hidden state (input to hidden)
-    Matrix *output_weights; // Weights for the output (hidden to output)
-    Matrix *hidden_state;   // Current hidden state of the RNN
+    int input_size;              // Size of the input vector (e.g., vocabulary size)
+    int hidden_size;             // Size of the hidden state vector
+    int output_size;             // Size of the output vector (e.g., vocabulary size)
+    double learning_rate;        // Learning rate for training
+    Matrix *hidden_weights;      // Weights for the hidden state (input to hidden)
+    Matrix *output_weights;      // Weights for the output (hidden to output)
+    Matrix *hidden_state;        // Current hidden state of the RNN
+    SparseMatrix *output_sparse; // Pruned output weights in CSR form, NULL when dense
+    int output_block_cols;       // Column run length output_sparse was pruned in, 1 when unstructured
+    Matrix *output_left;         // Factored output weights (V x r), NULL unless low-rank
+    Matrix *output_right;        // Factored output weights (r x H); output_weights is then NULL
 } RNN;
 
+// Gradients with the same shapes as the weights they belong to
+typedef struct
+{
+    Matrix *hidden_weights;
+    Matrix *output_weights; // NULL for a factored model
+    Matrix *output_left;    // NULL unless the model is factored
+    Matrix *output_right;   // NULL unless the model is factored
+} RNNGradients;
+
+// Memory footprint of a model, used for capacity planning
+typedef struct
+{
+    size_t weight_bytes;    // Weight matrices and the saved hidden state
+    size_t gradient_bytes;  // Gradient matrices at their high-water mark
+    size_t workspace_bytes; // All other matrices at their high-water mark
+    long peak_rss_kb;       // Peak resident set size of the process
+} RNNMemoryUsage;
+
+// Per-sequence state for forward-only inference (see rnn_step)
+typedef struct
+{
+    double *hidden;    // Hidden state, hidden_size entries
+    double *projected; // Scratch for a factored output projection, NULL otherwise
+    double *output;    // Output of the last step, output_size entries
+} RNNState;
+
+// Workspace for backpropagation through time over windows of seq_len tokens.
+// The forward pass stores only every checkpoint_every-th hidden state and the
+// backward pass recomputes the rest one segment at a time, so a window keeps
+// (seq_len / k + k - 1) hidden states instead of seq_len.
+typedef struct
+{
+    int seq_len;
+    int checkpoint_every; // k: steps per segment, 1 stores every hidden state
+    int num_checkpoints;  // Segments per window
+    double *checkpoints;  // Hidden state at the end of each segment
+    double *segment;      // Recomputed states of one segment, k - 1 of them
+    double *hidden;       // Running state of the forward pass
+    double *hidden_error; // Gradient carried from one step to the previous
+    double *output;       // Output error of the current step
+    double *projected;    // Factored projection of the current step, NULL unless low-rank
+    double *projected_error;
+    long recomputed_steps; // Forward steps repeated by the backward passes so far
+} RNNBptt;
+
 RNN *rnn_init(int input_size, int hidden_size, int output_size, double learning_rate);
 void rnn_free(RNN *rnn);
-Matrix *rnn_forward(RNN *rnn, Matrix *input);               // Forward pass
-void rnn_backward(RNN *rnn, Matrix *input, Matrix *target); // Backward pass (backpropagation through time)
+void rnn_grow_vocabulary(RNN *rnn, int vocab_size); // Add weights for appended words
+Matrix *rnn_forward(RNN *rnn, Matrix *input);                 // Forward pass
+Matrix *rnn_output_projection(RNN *rnn, Matrix *hidden);      // Output for a given hidden state
+double rnn_backward(RNN *rnn, Matrix *input, Matrix *target); // Backward pass (backpropagation through time)
 char *rnn_generate_text(Vocabulary *v, RNN *rnn, char *initial_input, int length);
 void rnn_save(RNN *rnn, const char *filename);
-RNN *rnn_load(const char *filename);
\ No newline at end of file
+RNN *rnn_load(const char *filename);
+void rnn_memory_usage(RNN *rnn, RNNMemoryUsage *usage);
+void rnn_memory_report(RNN *rnn, FILE *out, const char *label);
+
+// Forward-only inference; the model is only read, so states may run concurrently
+RNNState *rnn_state_create(const RNN *rnn);
+void rnn_state_free(RNNState *state);
+void rnn_state_reset(const RNN *rnn, RNNState *state);
+void rnn_state_restore(const RNN *rnn, RNNState *state);
+const double *rnn_step(const RNN *rnn, RNNState *state, int token);
+void rnn_step_hidden(const RNN *rnn, double *hidden, int token);
+void rnn_project_batch(const RNN *rnn, const double *hidden, int count, double *projected, double *output);
+int rnn_output_argmax(const RNN *rnn, const double *output);
+int rnn_state_argmax(const RNN *rnn, const RNNState *state);
+void rnn_generate_tokens(const RNN *rnn, RNNState *state, int token, int length, int *out);
+
+// Gradient accumulation, for training that applies updates separately (e.g. data parallel)
+RNNGradients *rnn_gradients_create(RNN *rnn);
+void rnn_gradients_free(RNNGradients *grads);
+void rnn_gradients_zero(RNNGradients *grads);
+size_t rnn_gradients_size(RNNGradients *grads);
+void rnn_gradients_pack(RNNGradients *grads, double *buffer);
+void rnn_gradients_unpack(RNNGradients *grads, const double *buffer);
+double rnn_accumulate_gradients(RNN *rnn, Matrix *input, Matrix *target, RNNGradients *grads);
+RNNBptt *rnn_bptt_create(const RNN *rnn, int seq_len, int checkpoint_every);
+void rnn_bptt_free(RNNBptt *bptt);
+size_t rnn_bptt_activation_bytes(const RNN *rnn, const RNNBptt *bptt);
+double rnn_bptt_accumulate(RNN *rnn, RNNBptt *bptt, const uint32_t *inputs, const uint32_t *targets,
+                           RNNGradients *grads);
+void rnn_apply_gradients(RNN *rnn, RNNGradients *grads, double scale);
+size_t rnn_parameter_count(RNN *rnn);
+void rnn_parameters_pack(RNN *rnn, double *buffer);
+void rnn_parameters_unpack(RNN *rnn, const double *buffer);
+
+// Pruning
+double rnn_prune_output(RNN *rnn, double sparsity, int block_cols);
+void rnn_densify_output(RNN *rnn); // Dense output_weights again, to train or grow a pruned model
+
+// Low-rank output projection
+int rnn_factorize_output(RNN *rnn, double energy, int max_rank, double *retained);
+void rnn_use_low_rank_output(RNN *rnn, int rank);
+
+// Kernel tuning
+int rnn_kernel_shapes(const RNN *rnn, MatrixShape *shapes, int max_shapes);
+int rnn_autotune(const RNN *rnn, FILE *log);
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "speculative.h"
+
+static void *speculative_alloc(size_t size)
+{
+    void *p = malloc(size ? size : 1);
+    if (!p)
+    {
+        fprintf(stderr, "Error: Unable to allocate memory for speculative decoding\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+// Pick the window with the most tokens expected per unit of projection work,
+// given the chance p that a draft token is confirmed. matrix_gemv_batch does
+// groups of four positions for about the price of two single products.
+static int choose_window(double p, int draft_length)
+{
+    int best = 1;
+    double best_rate = 1.0;
+    double expected = 1.0, chance = 1.0;
+    for (int k = 2; k <= draft_length; k++)
+    {
+        chance *= p;
+        expected += chance;
+        double cost = k / 4 * 2 + k % 4;
+        if (expected / cost > best_rate)
+        {
+            best = k;
+            best_rate = expected / cost;
+        }
+    }
+    return best;
+}
+
+// Running estimate of the draft's hit rate
+static void observe(double *p, int confirmed)
+{
+    *p = 0.9 * *p + 0.1 * confirmed;
+}
+
+void speculative_generate(const RNN *rnn, const NgramModel *draft, RNNState *state, int token, int length,
+                          int draft_length, int *out, SpeculativeStats *stats)
+{
+    int h = rnn->hidden_size, v = rnn->output_size;
+    int rank = rnn->output_right ? rnn->output_right->rows : 0;
+    if (draft_length < 1)
+        draft_length = 1;
+
+    // Inputs so far, for the draft's context: token, out[0], out[1], ...
+    uint32_t *history = (uint32_t *)speculative_alloc((length + draft_length + 1) * sizeof(uint32_t));
+    int *inputs = (int *)speculative_alloc(draft_length * sizeof(int));
+    double *hidden = (double *)speculative_alloc((size_t)draft_length * h * sizeof(double));
+    double *projected = rank ? (double *)speculative_alloc((size_t)draft_length * rank * sizeof(double)) : NULL;
+    double *output = (double *)speculative_alloc((size_t)draft_length * v * sizeof(double));
+    int history_length = 0;
+    history[history_length++] = (uint32_t)token;
+
+    SpeculativeStats local = {0, 0, 0, 0};
+    int produced = 0;
+    double hit_rate = 1.0;
+    while (produced < length)
+    {
+        // Position 0 feeds the known input; positions 1.. feed drafted guesses of the outputs
+        int window = choose_window(hit_rate, draft_length);
+        int k = window < length - produced ? window : length - produced;
+        inputs[0] = token;
+        for (int i = 1; i < k; i++)
+        {
+            uint32_t guess = ngram_predict(draft, history, history_length + i - 1);
+            if (guess >= (uint32_t)rnn->input_size)
+            {
+                k = i; // Not a token the RNN knows; verify what we have
+                break;
+            }
+            history[history_length + i - 1] = guess;
+            inputs[i] = (int)guess;
+        }
+
+        // The recurrence is cheap; keep every hidden state so a mismatch can roll back
+        memcpy(hidden, state->hidden, h * sizeof(double));
+        rnn_step_hidden(rnn, hidden, inputs[0]);
+        for (int i = 1; i < k; i++)
+        {
+            memcpy(hidden + (size_t)i * h, hidden + (size_t)(i - 1) * h, h * sizeof(double));
+            rnn_step_hidden(rnn, hidden + (size_t)i * h, inputs[i]);
+        }
+        rnn_project_batch(rnn, hidden, k, projected, output);
+
+        // Without drafts this pass, still score what the draft would have said
+        uint32_t shadow = k == 1 && draft_length > 1 ? ngram_predict(draft, history, history_length) : 0;
+
+        // Output i is greedy's as long as every drafted input before it was right
+        int accepted = 0;
+        while (accepted < k)
+        {
+            int predicted = rnn_output_argmax(rnn, output + (size_t)accepted * v);
+            out[produced++] = predicted;
+            history[history_length++] = (uint32_t)predicted;
+            token = predicted;
+            accepted++;
+            if (accepted < k)
+            {
+                observe(&hit_rate, inputs[accepted] == predicted);
+                if (inputs[accepted] != predicted)
+                    break;
+            }
+            else if (k == 1 && draft_length > 1)
+                observe(&hit_rate, shadow == (uint32_t)predicted);
+        }
+        memcpy(state->hidden, hidden + (size_t)(accepted - 1) * h, h * sizeof(double));
+
+        local.passes++;
+        local.drafted += k - 1;
+        local.accepted += accepted - 1;
+    }
+    local.tokens = produced;
+
+    if (stats)
+    {
+        stats->passes += local.passes;
+        stats->tokens += local.tokens;
+        stats->drafted += local.drafted;
+        stats->accepted += local.accepted;
+    }
+    free(history);
+    free(inputs);
+    free(hidden);
+    free(projected);
+    free(output);
+}
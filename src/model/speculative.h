@@ -0,0 +1,23 @@
+#pragma once
+#include "rnn.h"
+#include "ngram.h"
+
+typedef struct
+{
+    long passes;   // Batched RNN verification passes
+    long tokens;   // Tokens generated
+    long drafted;  // Draft tokens proposed
+    long accepted; // Draft tokens the RNN confirmed
+} SpeculativeStats;
+
+// Greedy generation that lets an n-gram draft propose up to draft_length - 1
+// tokens ahead. The RNN runs its cheap recurrence over the drafted inputs and
+// verifies all positions with one batched output projection; the longest
+// confirmed prefix plus the RNN's own next token are kept and the hidden
+// state rolls back to the last kept one. The window follows the draft's hit
+// rate, down to plain greedy steps while verifying drafts would not pay off.
+// out receives exactly what
+// rnn_generate_tokens would produce from the same state. stats, if not NULL,
+// is added to.
+void speculative_generate(const RNN *rnn, const NgramModel *draft, RNNState *state, int token, int length,
+                          int draft_length, int *out, SpeculativeStats *stats);
@@ -0,0 +1,350 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "comm.h"
+
+#define CONNECT_RETRIES 300
+#define CONNECT_RETRY_US 100000
+
+// Split "host:port" into its parts; host is written to a buffer of host_size bytes
+static int parse_endpoint(const char *endpoint, char *host, size_t host_size, char *port, size_t port_size)
+{
+    const char *colon = strrchr(endpoint, ':');
+    if (!colon || (size_t)(colon - endpoint) >= host_size || strlen(colon + 1) >= port_size)
+    {
+        fprintf(stderr, "Error: Invalid endpoint '%s', expected host:port\n", endpoint);
+        return -1;
+    }
+    memcpy(host, endpoint, colon - endpoint);
+    host[colon - endpoint] = '\0';
+    strcpy(port, colon + 1);
+    return 0;
+}
+
+static void configure_socket(int fd)
+{
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+static int listen_on(const char *endpoint)
+{
+    char host[256], port[32];
+    if (parse_endpoint(endpoint, host, sizeof(host), port, sizeof(port)) != 0)
+        return -1;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        perror("Failed to create socket");
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((unsigned short)atoi(port));
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 1) != 0)
+    {
+        fprintf(stderr, "Error: Unable to listen on port %s: %s\n", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Connect to a peer, retrying while it is still starting up
+static int connect_to(const char *endpoint)
+{
+    char host[256], port[32];
+    if (parse_endpoint(endpoint, host, sizeof(host), port, sizeof(port)) != 0)
+        return -1;
+
+    struct addrinfo hints, *info;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &info) != 0)
+    {
+        fprintf(stderr, "Error: Unable to resolve %s\n", endpoint);
+        return -1;
+    }
+
+    for (int attempt = 0; attempt < CONNECT_RETRIES; attempt++)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, info->ai_addr, info->ai_addrlen) == 0)
+        {
+            freeaddrinfo(info);
+            return fd;
+        }
+        if (fd >= 0)
+            close(fd);
+        usleep(CONNECT_RETRY_US);
+    }
+    freeaddrinfo(info);
+    fprintf(stderr, "Error: Unable to connect to %s\n", endpoint);
+    return -1;
+}
+
+Communicator *comm_create(int rank, int world_size, char **endpoints)
+{
+    Communicator *c = (Communicator *)calloc(1, sizeof(Communicator));
+    if (!c)
+        return NULL;
+    c->rank = rank;
+    c->world_size = world_size;
+    c->send_fd = -1;
+    c->recv_fd = -1;
+    if (world_size == 1)
+        return c;
+
+    // Listen before connecting so that no rank waits on another's accept
+    int listen_fd = listen_on(endpoints[rank]);
+    if (listen_fd < 0)
+    {
+        free(c);
+        return NULL;
+    }
+    c->send_fd = connect_to(endpoints[(rank + 1) % world_size]);
+    c->recv_fd = c->send_fd >= 0 ? accept(listen_fd, NULL, NULL) : -1;
+    close(listen_fd);
+    if (c->send_fd < 0 || c->recv_fd < 0)
+    {
+        comm_free(c);
+        return NULL;
+    }
+    configure_socket(c->send_fd);
+    configure_socket(c->recv_fd);
+    return c;
+}
+
+void comm_free(Communicator *c)
+{
+    if (c)
+    {
+        if (c->send_fd >= 0)
+            close(c->send_fd);
+        if (c->recv_fd >= 0)
+            close(c->recv_fd);
+        free(c->scratch);
+        free(c);
+    }
+}
+
+// Send to the next rank and receive from the previous one at the same time,
+// so large messages cannot deadlock on full socket buffers
+static int exchange(Communicator *c, const void *send_buf, size_t send_size, void *recv_buf, size_t recv_size)
+{
+    size_t sent = 0, received = 0;
+    while (sent < send_size || received < recv_size)
+    {
+        struct pollfd fds[2];
+        int n = 0;
+        if (sent < send_size)
+            fds[n++] = (struct pollfd){.fd = c->send_fd, .events = POLLOUT};
+        if (received < recv_size)
+            fds[n++] = (struct pollfd){.fd = c->recv_fd, .events = POLLIN};
+        if (poll(fds, n, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("poll failed during all-reduce");
+            return -1;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            if (!fds[i].revents)
+                continue;
+            ssize_t k;
+            if (fds[i].fd == c->send_fd && sent < send_size)
+                k = send(c->send_fd, (const char *)send_buf + sent, send_size - sent, MSG_NOSIGNAL);
+            else
+                k = recv(c->recv_fd, (char *)recv_buf + received, recv_size - received, 0);
+
+            if (k < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+                continue;
+            if (k <= 0)
+            {
+                fprintf(stderr, "Error: Rank %d lost its connection to a neighbour\n", c->rank);
+                return -1;
+            }
+            if (fds[i].fd == c->send_fd)
+                sent += k;
+            else
+                received += k;
+        }
+    }
+    return 0;
+}
+
+static size_t chunk_start(size_t count, int world_size, int chunk)
+{
+    return count * chunk / world_size;
+}
+
+// Ring all-reduce: a reduce-scatter leaves every rank with one fully summed
+// chunk, then an all-gather copies those chunks around the ring. Each chunk
+// is summed by exactly one rank, so all ranks end with identical bits.
+int comm_allreduce_sum(Communicator *c, double *data, size_t count)
+{
+    int n = c->world_size;
+    if (n == 1 || count == 0)
+        return 0;
+
+    size_t max_chunk = count / n + 1;
+    if (c->scratch_size < max_chunk)
+    {
+        free(c->scratch);
+        c->scratch = (double *)malloc(max_chunk * sizeof(double));
+        if (!c->scratch)
+        {
+            fprintf(stderr, "Error: Unable to allocate memory for all-reduce\n");
+            return -1;
+        }
+        c->scratch_size = max_chunk;
+    }
+
+    for (int step = 0; step < n - 1; step++)
+    {
+        int send_chunk = (c->rank - step + n) % n;
+        int recv_chunk = (c->rank - step - 1 + n) % n;
+        size_t send_begin = chunk_start(count, n, send_chunk);
+        size_t send_end = chunk_start(count, n, send_chunk + 1);
+        size_t recv_begin = chunk_start(count, n, recv_chunk);
+        size_t recv_end = chunk_start(count, n, recv_chunk + 1);
+
+        if (exchange(c, data + send_begin, (send_end - send_begin) * sizeof(double),
+                     c->scratch, (recv_end - recv_begin) * sizeof(double)) != 0)
+            return -1;
+        for (size_t i = recv_begin; i < recv_end; i++)
+            data[i] += c->scratch[i - recv_begin];
+    }
+
+    for (int step = 0; step < n - 1; step++)
+    {
+        int send_chunk = (c->rank - step + 1 + n) % n;
+        int recv_chunk = (c->rank - step + n) % n;
+        size_t send_begin = chunk_start(count, n, send_chunk);
+        size_t send_end = chunk_start(count, n, send_chunk + 1);
+        size_t recv_begin = chunk_start(count, n, recv_chunk);
+        size_t recv_end = chunk_start(count, n, recv_chunk + 1);
+
+        if (exchange(c, data + send_begin, (send_end - send_begin) * sizeof(double),
+                     data + recv_begin, (recv_end - recv_begin) * sizeof(double)) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+// Pass rank 0's buffer once around the ring
+int comm_broadcast(Communicator *c, double *data, size_t count)
+{
+    if (c->world_size == 1)
+        return 0;
+
+    size_t size = count * sizeof(double);
+    if (c->rank != 0 && exchange(c, NULL, 0, data, size) != 0)
+        return -1;
+    if (c->rank != c->world_size - 1 && exchange(c, data, size, NULL, 0) != 0)
+        return -1;
+    return 0;
+}
+
+static void *async_thread(void *arg)
+{
+    AsyncAllreduce *a = (AsyncAllreduce *)arg;
+
+    pthread_mutex_lock(&a->lock);
+    for (;;)
+    {
+        while (!a->running && !a->stop)
+            pthread_cond_wait(&a->changed, &a->lock);
+        if (a->stop)
+            break;
+
+        pthread_mutex_unlock(&a->lock);
+        int status = comm_allreduce_sum(a->comm, a->data, a->count);
+        pthread_mutex_lock(&a->lock);
+
+        a->status = status;
+        a->running = 0;
+        pthread_cond_broadcast(&a->changed);
+    }
+    pthread_mutex_unlock(&a->lock);
+    return NULL;
+}
+
+AsyncAllreduce *comm_async_create(Communicator *c)
+{
+    AsyncAllreduce *a = (AsyncAllreduce *)calloc(1, sizeof(AsyncAllreduce));
+    if (!a)
+        return NULL;
+    a->comm = c;
+    pthread_mutex_init(&a->lock, NULL);
+    pthread_cond_init(&a->changed, NULL);
+    if (pthread_create(&a->thread, NULL, async_thread, a) != 0)
+    {
+        fprintf(stderr, "Error: Unable to start all-reduce thread\n");
+        exit(EXIT_FAILURE);
+    }
+    return a;
+}
+
+// Start summing data across ranks; data must not be touched until comm_async_wait
+void comm_async_start(AsyncAllreduce *a, double *data, size_t count)
+{
+    pthread_mutex_lock(&a->lock);
+    a->data = data;
+    a->count = count;
+    a->pending = 1;
+    a->running = 1;
+    pthread_cond_broadcast(&a->changed);
+    pthread_mutex_unlock(&a->lock);
+}
+
+// Wait for the started all-reduce; returns its status, or 1 if none was pending
+int comm_async_wait(AsyncAllreduce *a)
+{
+    pthread_mutex_lock(&a->lock);
+    if (!a->pending)
+    {
+        pthread_mutex_unlock(&a->lock);
+        return 1;
+    }
+    while (a->running)
+        pthread_cond_wait(&a->changed, &a->lock);
+    a->pending = 0;
+    int status = a->status;
+    pthread_mutex_unlock(&a->lock);
+    return status;
+}
+
+void comm_async_free(AsyncAllreduce *a)
+{
+    if (!a)
+        return;
+    comm_async_wait(a);
+    pthread_mutex_lock(&a->lock);
+    a->stop = 1;
+    pthread_cond_broadcast(&a->changed);
+    pthread_mutex_unlock(&a->lock);
+    pthread_join(a->thread, NULL);
+    pthread_mutex_destroy(&a->lock);
+    pthread_cond_destroy(&a->changed);
+    free(a);
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <stddef.h>
+#include <pthread.h>
+
+// Ring of worker processes connected over TCP. Every rank connects to the
+// next rank and accepts a connection from the previous one.
+typedef struct
+{
+    int rank;
+    int world_size;
+    int send_fd;      // Connection to rank + 1
+    int recv_fd;      // Connection from rank - 1
+    double *scratch;  // Receive buffer for one all-reduce chunk
+    size_t scratch_size;
+} Communicator;
+
+// Runs all-reduces on a background thread so communication overlaps compute
+typedef struct
+{
+    Communicator *comm;
+    double *data;
+    size_t count;
+    int pending; // A job was started and not yet waited for
+    int running; // The thread is working on the job
+    int status;  // Result of the last all-reduce
+    int stop;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} AsyncAllreduce;
+
+// endpoints[i] is "host:port" of rank i; this rank listens on its own port
+Communicator *comm_create(int rank, int world_size, char **endpoints);
+void comm_free(Communicator *c);
+
+// Collectives; all ranks must call them in the same order. Return 0 on success.
+int comm_allreduce_sum(Communicator *c, double *data, size_t count);
+int comm_broadcast(Communicator *c, double *data, size_t count); // From rank 0
+
+AsyncAllreduce *comm_async_create(Communicator *c);
+void comm_async_start(AsyncAllreduce *a, double *data, size_t count);
+int comm_async_wait(AsyncAllreduce *a);
+void comm_async_free(AsyncAllreduce *a);
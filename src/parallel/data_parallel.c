@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "data_parallel.h"
+#include "comm.h"
+#include "../data/dataset.h"
+#include "../model/rnn.h"
+#include "../vocabulary/vocabulary.h"
+
+// Gradient exchange state of one worker
+typedef struct
+{
+    Communicator *comm;
+    AsyncAllreduce *async;   // NULL when communication is not overlapped
+    RNNGradients *reduced;   // Summed gradients unpacked for applying
+    double *buffers[2];      // Local gradients being packed / in flight
+    int in_flight;           // Index of the buffer being all-reduced, -1 if none
+    size_t count;            // Doubles per buffer
+    double comm_wait_seconds; // Time the trainer spent blocked on communication
+} GradientSync;
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void apply_reduced(RNN *rnn, GradientSync *sync, const double *buffer)
+{
+    rnn_gradients_unpack(sync->reduced, buffer);
+    rnn_apply_gradients(rnn, sync->reduced, 1.0 / sync->comm->world_size);
+}
+
+// Wait for the in-flight all-reduce, if any, and apply its result
+static int sync_drain(RNN *rnn, GradientSync *sync)
+{
+    if (sync->in_flight < 0)
+        return 0;
+
+    double start = now_seconds();
+    int status = comm_async_wait(sync->async);
+    sync->comm_wait_seconds += now_seconds() - start;
+    if (status != 0)
+        return -1;
+
+    apply_reduced(rnn, sync, sync->buffers[sync->in_flight]);
+    sync->in_flight = -1;
+    return 0;
+}
+
+// Exchange the locally accumulated gradients. When overlapped, the update is
+// applied one sync later, after the next steps were computed with the old
+// weights; all ranks apply the same updates at the same step either way.
+static int sync_gradients(RNN *rnn, RNNGradients *grads, GradientSync *sync)
+{
+    int slot = sync->in_flight == 0 ? 1 : 0;
+    rnn_gradients_pack(grads, sync->buffers[slot]);
+    rnn_gradients_zero(grads);
+
+    if (!sync->async)
+    {
+        double start = now_seconds();
+        int status = comm_allreduce_sum(sync->comm, sync->buffers[slot], sync->count);
+        sync->comm_wait_seconds += now_seconds() - start;
+        if (status != 0)
+            return -1;
+        apply_reduced(rnn, sync, sync->buffers[slot]);
+        return 0;
+    }
+
+    if (sync_drain(rnn, sync) != 0)
+        return -1;
+    comm_async_start(sync->async, sync->buffers[slot], sync->count);
+    sync->in_flight = slot;
+    return 0;
+}
+
+static uint64_t weights_fingerprint(RNN *rnn, double *buffer, size_t count)
+{
+    rnn_parameters_pack(rnn, buffer);
+    uint64_t hash = 0xcbf29ce484222325ull;
+    const unsigned char *bytes = (const unsigned char *)buffer;
+    for (size_t i = 0; i < count * sizeof(double); i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+int data_parallel_train(const TrainConfig *config)
+{
+    int rank = config->rank;
+    Vocabulary *v = vocabulary_load(config->vocab_path);
+    Dataset *dataset = v ? dataset_open(config->tokens_path) : NULL;
+    if (!dataset)
+    {
+        vocabulary_free(v);
+        return -1;
+    }
+    if (dataset->header.vocab_hash != vocabulary_hash(v))
+    {
+        fprintf(stderr, "Error: %s was not encoded with vocabulary %s\n", config->tokens_path, config->vocab_path);
+        dataset_close(dataset);
+        vocabulary_free(v);
+        return -1;
+    }
+
+    Communicator *comm = comm_create(rank, config->world_size, config->endpoints);
+    if (!comm)
+    {
+        dataset_close(dataset);
+        vocabulary_free(v);
+        return -1;
+    }
+
+    RNN *rnn = rnn_init(v->size, config->hidden_size, v->size, config->learning_rate);
+    if (config->output_rank > 0)
+        rnn_use_low_rank_output(rnn, config->output_rank);
+    RNNGradients *grads = rnn_gradients_create(rnn);
+
+    GradientSync sync;
+    memset(&sync, 0, sizeof(sync));
+    sync.comm = comm;
+    sync.reduced = rnn_gradients_create(rnn);
+    sync.count = rnn_gradients_size(grads);
+    sync.in_flight = -1;
+    sync.buffers[0] = (double *)malloc(sync.count * sizeof(double));
+    sync.buffers[1] = (double *)malloc(sync.count * sizeof(double));
+    if (!sync.buffers[0] || !sync.buffers[1])
+    {
+        fprintf(stderr, "Error: Unable to allocate memory for gradient buffers\n");
+        exit(EXIT_FAILURE);
+    }
+    if (config->overlap && config->world_size > 1)
+        sync.async = comm_async_create(comm);
+
+    // Rank 0 tunes kernels first; the broadcast below holds the other ranks
+    // back, so those sharing its host find the shapes cached
+    if (rank == 0)
+        rnn_autotune(rnn, stdout);
+
+    // Start every rank from rank 0's initial weights
+    int status = 0;
+    rnn_parameters_pack(rnn, sync.buffers[0]);
+    if (comm_broadcast(comm, sync.buffers[0], rnn_parameter_count(rnn)) != 0)
+        status = -1;
+    rnn_parameters_unpack(rnn, sync.buffers[0]);
+    if (rank != 0)
+        rnn_autotune(rnn, NULL);
+
+    int seq_len = config->seq_len > 1 ? config->seq_len : 1;
+    DatasetIterator *it = dataset_iterator_create_sharded(dataset, seq_len, config->batch_size, 4, config->seed + rank,
+                                                          rank, config->world_size);
+    if (!it)
+        status = -1;
+    RNNBptt *bptt = seq_len > 1 ? rnn_bptt_create(rnn, seq_len, config->checkpoint_every) : NULL;
+
+    Matrix *input_vector = matrix_zero(v->size, 1);
+    Matrix *target_vector = matrix_zero(v->size, 1);
+    long step = 0;
+    double start = now_seconds();
+
+    for (int epoch = 0; status == 0 && epoch < config->epochs; epoch++)
+    {
+        double loss[2] = {0.0, 0.0}; // Sum of losses, number of samples
+        int last_in_epoch = 0;
+        while (status == 0 && !last_in_epoch)
+        {
+            DatasetBatch *batch = dataset_iterator_next(it);
+            if (!batch)
+            {
+                status = -1;
+                break;
+            }
+            for (int i = 0; status == 0 && i < batch->batch_size; i++)
+            {
+                if (bptt)
+                {
+                    size_t offset = (size_t)i * seq_len;
+                    loss[0] += rnn_bptt_accumulate(rnn, bptt, batch->inputs + offset, batch->targets + offset, grads);
+                    loss[1] += seq_len;
+                }
+                else
+                {
+                    matrix_fill(input_vector, 0.0);
+                    input_vector->entries[batch->inputs[i]][0] = 1.0;
+                    matrix_fill(target_vector, 0.0);
+                    target_vector->entries[batch->targets[i]][0] = 1.0;
+
+                    loss[0] += rnn_accumulate_gradients(rnn, input_vector, target_vector, grads);
+                    loss[1] += 1.0;
+                }
+                if (++step % config->sync_steps == 0)
+                    status = sync_gradients(rnn, grads, &sync);
+            }
+            last_in_epoch = batch->last_in_epoch;
+            dataset_iterator_release(it, batch);
+        }
+
+        // The loss all-reduce shares the sockets, so finish the gradient exchange first
+        if (status == 0)
+            status = sync_drain(rnn, &sync);
+        if (status == 0)
+            status = comm_allreduce_sum(comm, loss, 2);
+        if (status == 0 && rank == 0 && (epoch % 50 == 0 || epoch == config->epochs - 1))
+            printf("Epoch %d, Average Loss: %f\n", epoch, loss[0] / loss[1]);
+    }
+
+    // Apply gradients from the steps since the last sync
+    if (status == 0 && step % config->sync_steps != 0)
+        status = sync_gradients(rnn, grads, &sync);
+    if (status == 0)
+        status = sync_drain(rnn, &sync);
+    double elapsed = now_seconds() - start;
+
+    // Check that every rank ended with exactly rank 0's weights
+    if (status == 0)
+    {
+        uint64_t local = weights_fingerprint(rnn, sync.buffers[0], rnn_parameter_count(rnn));
+        uint64_t reference = local;
+        double mismatches = 0.0;
+        status = comm_broadcast(comm, (double *)&reference, 1);
+        mismatches = reference != local;
+        if (status == 0)
+            status = comm_allreduce_sum(comm, &mismatches, 1);
+        if (status == 0 && mismatches != 0.0)
+        {
+            if (rank == 0)
+                fprintf(stderr, "Error: Weights differ on %.0f worker(s)\n", mismatches);
+            status = -1;
+        }
+    }
+
+    if (status == 0 && rank == 0)
+    {
+        printf("Trained %ld steps per worker on %d worker(s) in %.2fs (%.0f samples/s, %.2fs waiting on gradients)\n",
+               step, config->world_size, elapsed, step * config->world_size / elapsed, sync.comm_wait_seconds);
+        if (bptt)
+            printf("BPTT over %d-token windows, checkpoint every %d steps: %.1f KiB of hidden states per window "
+                   "(%.1f KiB storing all), %ld hidden steps recomputed (%.0f%% of the forward pass)\n",
+                   seq_len, bptt->checkpoint_every, rnn_bptt_activation_bytes(rnn, bptt) / 1024.0,
+                   (double)seq_len * rnn->hidden_size * sizeof(double) / 1024.0, bptt->recomputed_steps,
+                   step ? 100.0 * bptt->recomputed_steps / ((double)step * seq_len) : 0.0);
+        rnn_save(rnn, config->model_path);
+    }
+
+    matrix_free(input_vector);
+    matrix_free(target_vector);
+    dataset_iterator_free(it);
+    rnn_bptt_free(bptt);
+    comm_async_free(sync.async);
+    free(sync.buffers[0]);
+    free(sync.buffers[1]);
+    rnn_gradients_free(sync.reduced);
+    rnn_gradients_free(grads);
+    rnn_free(rnn);
+    comm_free(comm);
+    dataset_close(dataset);
+    vocabulary_free(v);
+    return status;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <stdint.h>
+
+typedef struct
+{
+    const char *tokens_path; // Token file written by `rnn tokenize`
+    const char *vocab_path;  // Vocabulary the token file was encoded with
+    const char *model_path;  // Where rank 0 saves the trained model
+    int hidden_size;
+    int output_rank; // Train a factored output projection of this rank, 0 for dense
+    int epochs;
+    double learning_rate;
+    int batch_size;  // Windows per prefetched batch
+    int seq_len;     // Tokens per window; above 1 trains with BPTT over the window
+    int checkpoint_every; // BPTT stores every k-th hidden state, 0 for ceil(sqrt(seq_len))
+    int sync_steps;  // All-reduce gradients every sync_steps samples
+    int overlap;     // All-reduce on a background thread while computing the next steps
+    int rank;
+    int world_size;
+    char **endpoints; // "host:port" of every rank
+    uint64_t seed;
+} TrainConfig;
+
+// Train one worker of a data-parallel job. Every rank trains on its own shard
+// of the token stream; summed gradients are applied identically everywhere,
+// so the weights stay bit-identical across ranks. Returns 0 on success.
+int data_parallel_train(const TrainConfig *config);
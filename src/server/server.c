@@ -0,0 +1,812 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server.h"
+#include "../model/rnn.h"
+#include "../vocabulary/vocabulary.h"
+#include "../tokenizer/bpe.h"
+
+#define MAX_CONNECTIONS 256
+#define LATENCY_WINDOW 4096
+#define MAX_REPLY_WORD 64
+
+// A client connection, owned by the poll loop. Its socket is non-blocking and
+// only the poll loop writes to it, so a slow reader never stalls the server.
+typedef struct
+{
+    int fd;               // -1 when the slot is free
+    int busy;             // A request from this connection is queued or running
+    int closing;          // Close once the request finishes and the output is sent
+    unsigned char header[4];
+    uint32_t have;        // Bytes of header + payload received so far
+    uint32_t length;      // Payload length, valid once the header is complete
+    char *payload;
+    char *result;         // Reply text of the finished request, set by the worker
+    char *out;            // Framed replies not yet accepted by the socket
+    size_t out_length;    // Bytes in out; 0 when everything was sent
+    size_t out_sent;
+    size_t out_capacity;
+} Connection;
+
+typedef struct
+{
+    int connection;       // Slot in the connection table
+    char *payload;        // NUL terminated request text, owned by the request
+    double enqueued;      // Arrival time, for latency including queueing
+} Request;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    double started;
+    long requests;        // Answered GEN requests
+    long errors;          // GEN requests answered with ERR
+    long rejected;        // Refused because the queue was full
+    long tokens;          // Words generated
+    double latency_sum;   // Seconds, over all answered requests
+    double latencies[LATENCY_WINDOW]; // Most recent request latencies
+    long latency_count;
+} ServerStats;
+
+typedef struct
+{
+    const ServerConfig *config;
+    RNN *rnn;
+    Vocabulary *vocab;
+    Bpe *bpe;             // Subword merges when the model was trained on BPE tokens, or NULL
+
+    // Bounded FIFO of requests waiting for a worker
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    Request *queue;
+    int head;
+    int count;
+    int running;          // Requests a worker is generating right now
+    int shutdown;
+
+    Connection *connections; // MAX_CONNECTIONS slots
+    int wake[2];          // Workers write finished connection slots here for the poll loop
+    ServerStats stats;
+} Server;
+
+// Self-pipe for SIGINT / SIGTERM
+static int signal_pipe[2] = {-1, -1};
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void on_signal(int signum)
+{
+    (void)signum;
+    char byte = 0;
+    if (write(signal_pipe[1], &byte, 1) < 0)
+    {
+        // Nothing to do; the poll loop will not be woken
+    }
+}
+
+static int send_all(int fd, const void *data, size_t size)
+{
+    const char *p = (const char *)data;
+    while (size > 0)
+    {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+static int recv_all(int fd, void *data, size_t size)
+{
+    char *p = (char *)data;
+    while (size > 0)
+    {
+        ssize_t n = recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+int server_send_message(int fd, const char *data, uint32_t length)
+{
+    uint32_t header = htonl(length);
+    if (send_all(fd, &header, sizeof(header)) != 0)
+        return -1;
+    return send_all(fd, data, length);
+}
+
+char *server_recv_message(int fd, uint32_t *length)
+{
+    uint32_t header;
+    if (recv_all(fd, &header, sizeof(header)) != 0)
+        return NULL;
+    *length = ntohl(header);
+    if (*length > SERVER_MAX_MESSAGE)
+        return NULL;
+    char *data = (char *)malloc(*length + 1);
+    if (!data)
+        return NULL;
+    if (recv_all(fd, data, *length) != 0)
+    {
+        free(data);
+        return NULL;
+    }
+    data[*length] = '\0';
+    return data;
+}
+
+// Send buffered output as far as the socket takes it without blocking; the
+// rest goes when poll reports the socket writable. -1 when the peer is gone.
+static int connection_flush(Connection *c)
+{
+    while (c->out_sent < c->out_length)
+    {
+        ssize_t n = send(c->fd, c->out + c->out_sent, c->out_length - c->out_sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (n <= 0)
+            return -1;
+        c->out_sent += n;
+    }
+    c->out_length = c->out_sent = 0;
+    return 0;
+}
+
+// Queue a framed reply on the connection and start sending it
+static int connection_reply(Connection *c, const char *text)
+{
+    uint32_t length = (uint32_t)strlen(text);
+    size_t needed = c->out_length + sizeof(length) + length;
+    if (needed > c->out_capacity)
+    {
+        size_t capacity = needed > 2 * c->out_capacity ? needed : 2 * c->out_capacity;
+        char *out = (char *)realloc(c->out, capacity);
+        if (!out)
+            return -1;
+        c->out = out;
+        c->out_capacity = capacity;
+    }
+    uint32_t header = htonl(length);
+    memcpy(c->out + c->out_length, &header, sizeof(header));
+    memcpy(c->out + c->out_length + sizeof(header), text, length);
+    c->out_length = needed;
+    return connection_flush(c);
+}
+
+int server_connect(const char *address)
+{
+    const char *colon = strrchr(address, ':');
+    int fd;
+    if (colon)
+    {
+        char host[256];
+        if ((size_t)(colon - address) >= sizeof(host))
+            return -1;
+        memcpy(host, address, colon - address);
+        host[colon - address] = '\0';
+
+        struct addrinfo hints, *info;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host, colon + 1, &hints, &info) != 0)
+        {
+            fprintf(stderr, "Error: Unable to resolve %s\n", address);
+            return -1;
+        }
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, info->ai_addr, info->ai_addrlen) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(info);
+        if (fd >= 0)
+        {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+    }
+    else
+    {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(address) >= sizeof(addr.sun_path))
+            return -1;
+        strcpy(addr.sun_path, address);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd < 0)
+        fprintf(stderr, "Error: Unable to connect to %s: %s\n", address, strerror(errno));
+    return fd;
+}
+
+static int listen_socket(const ServerConfig *config)
+{
+    int fd;
+    if (config->socket_path)
+    {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(config->socket_path) >= sizeof(addr.sun_path))
+        {
+            fprintf(stderr, "Error: Socket path %s is too long\n", config->socket_path);
+            return -1;
+        }
+        strcpy(addr.sun_path, config->socket_path);
+        unlink(config->socket_path); // Left behind by a previous run
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0))
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    else
+    {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons((unsigned short)config->port);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        if (fd >= 0)
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (fd >= 0 && (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0))
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd < 0)
+        perror("Failed to listen");
+    return fd;
+}
+
+static void stats_record(ServerStats *stats, double latency, int tokens, int failed)
+{
+    pthread_mutex_lock(&stats->lock);
+    stats->requests++;
+    stats->errors += failed;
+    stats->tokens += tokens;
+    stats->latency_sum += latency;
+    stats->latencies[stats->latency_count++ % LATENCY_WINDOW] = latency;
+    pthread_mutex_unlock(&stats->lock);
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void format_stats(Server *server, char *text, size_t size)
+{
+    ServerStats *stats = &server->stats;
+    double window[LATENCY_WINDOW];
+
+    pthread_mutex_lock(&server->lock);
+    int queued = server->count, running = server->running;
+    pthread_mutex_unlock(&server->lock);
+
+    pthread_mutex_lock(&stats->lock);
+    long requests = stats->requests, errors = stats->errors, rejected = stats->rejected, tokens = stats->tokens;
+    double latency_sum = stats->latency_sum;
+    int samples = stats->latency_count < LATENCY_WINDOW ? (int)stats->latency_count : LATENCY_WINDOW;
+    memcpy(window, stats->latencies, samples * sizeof(double));
+    double uptime = now_seconds() - stats->started;
+    pthread_mutex_unlock(&stats->lock);
+
+    // Percentiles over the most recent requests
+    qsort(window, samples, sizeof(double), compare_doubles);
+    double p50 = samples ? window[samples / 2] : 0.0;
+    double p90 = samples ? window[samples * 9 / 10] : 0.0;
+    double p99 = samples ? window[samples * 99 / 100] : 0.0;
+    double max = samples ? window[samples - 1] : 0.0;
+
+    snprintf(text, size,
+             "OK uptime_s=%.1f requests=%ld errors=%ld rejected=%ld queued=%d running=%d workers=%d qps=%.2f "
+             "tokens_per_s=%.1f latency_ms_mean=%.3f latency_ms_p50=%.3f latency_ms_p90=%.3f "
+             "latency_ms_p99=%.3f latency_ms_max=%.3f",
+             uptime, requests, errors, rejected, queued, running, server->config->workers,
+             uptime > 0.0 ? requests / uptime : 0.0, uptime > 0.0 ? tokens / uptime : 0.0,
+             requests ? latency_sum * 1e3 / requests : 0.0, p50 * 1e3, p90 * 1e3, p99 * 1e3, max * 1e3);
+}
+
+// GEN for a model trained on BPE tokens: the prompt text is encoded with the
+// merges and the generated subwords are decoded back into text
+static int handle_generate_bpe(Server *server, RNNState *state, int *tokens, int length, const char *prompt,
+                               char **text)
+{
+    const RNN *rnn = server->rnn;
+    size_t num_ids;
+    uint32_t *ids = bpe_tokenize(server->bpe, prompt, &num_ids);
+    if (!ids)
+        return -1;
+    // bpe_tokenize ends every line with EOS; the prompt continues instead
+    while (num_ids > 0 && ids[num_ids - 1] == VOCAB_EOS)
+        num_ids--;
+    if (num_ids == 0)
+    {
+        free(ids);
+        *text = strdup("ERR missing prompt");
+        return -1;
+    }
+
+    rnn_state_restore(rnn, state);
+    for (size_t i = 0; i + 1 < num_ids; i++)
+        rnn_step(rnn, state, (int)ids[i]);
+    rnn_generate_tokens(rnn, state, (int)ids[num_ids - 1], length, tokens);
+    free(ids);
+
+    uint32_t *generated = (uint32_t *)malloc(length * sizeof(uint32_t));
+    if (!generated)
+        return -1;
+    for (int i = 0; i < length; i++)
+        generated[i] = (uint32_t)tokens[i];
+    char *decoded = bpe_decode(server->bpe, generated, length);
+    free(generated);
+    if (!decoded)
+        return -1;
+    size_t size = strlen(decoded) + 4;
+    *text = (char *)malloc(size);
+    if (*text)
+        snprintf(*text, size, "OK %s", decoded);
+    free(decoded);
+    return *text ? length : -1;
+}
+
+// Run "GEN <length> <prompt words...>" with the worker's own state; returns the words generated
+static int handle_generate(Server *server, RNNState *state, int *tokens, char *payload, char **text)
+{
+    const RNN *rnn = server->rnn;
+    char *save = NULL;
+    strtok_r(payload, " \t\r\n", &save);
+    char *length_word = strtok_r(NULL, " \t\r\n", &save);
+    int length = length_word ? atoi(length_word) : 0;
+    if (length < 1 || length > server->config->max_length)
+    {
+        *text = strdup("ERR length must be between 1 and the server maximum");
+        return -1;
+    }
+
+    if (server->bpe)
+        return handle_generate_bpe(server, state, tokens, length, save, text);
+
+    // Feed the prompt; the last word is where generation starts
+    rnn_state_restore(rnn, state);
+    int token = -1;
+    for (char *word = strtok_r(NULL, " \t\r\n", &save); word; word = strtok_r(NULL, " \t\r\n", &save))
+    {
+        if (token >= 0)
+            rnn_step(rnn, state, token);
+        token = vocabulary_get_index(server->vocab, word);
+        if (token < 0 || token >= rnn->input_size)
+            token = VOCAB_UNK;
+    }
+    if (token < 0)
+    {
+        *text = strdup("ERR missing prompt");
+        return -1;
+    }
+
+    rnn_generate_tokens(rnn, state, token, length, tokens);
+    size_t size = 4 + (size_t)length * (MAX_REPLY_WORD + 1);
+    *text = (char *)malloc(size);
+    if (!*text)
+        return -1;
+    size_t used = snprintf(*text, size, "OK");
+    for (int i = 0; i < length; i++)
+        used += snprintf(*text + used, size - used, " %.*s", MAX_REPLY_WORD,
+                         vocabulary_get_word(server->vocab, tokens[i]));
+    return length;
+}
+
+static void *worker_main(void *arg)
+{
+    Server *server = (Server *)arg;
+    RNNState *state = rnn_state_create(server->rnn);
+    int *tokens = (int *)malloc(server->config->max_length * sizeof(int));
+    if (!tokens)
+    {
+        fprintf(stderr, "Error: Unable to allocate memory for a server worker\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (;;)
+    {
+        pthread_mutex_lock(&server->lock);
+        while (server->count == 0 && !server->shutdown)
+            pthread_cond_wait(&server->ready, &server->lock);
+        if (server->count == 0)
+        {
+            pthread_mutex_unlock(&server->lock);
+            break;
+        }
+        Request request = server->queue[server->head];
+        server->head = (server->head + 1) % server->config->queue_size;
+        server->count--;
+        server->running++;
+        pthread_mutex_unlock(&server->lock);
+
+        char *text = NULL;
+        int generated = handle_generate(server, state, tokens, request.payload, &text);
+        stats_record(&server->stats, now_seconds() - request.enqueued, generated > 0 ? generated : 0, generated < 0);
+        pthread_mutex_lock(&server->lock);
+        server->running--;
+        pthread_mutex_unlock(&server->lock);
+
+        free(request.payload);
+
+        // Hand the connection and its reply back to the poll loop, which sends it
+        server->connections[request.connection].result = text;
+        if (write(server->wake[1], &request.connection, sizeof(int)) != sizeof(int))
+            perror("Failed to wake the server loop");
+    }
+
+    free(tokens);
+    rnn_state_free(state);
+    return NULL;
+}
+
+static void connection_close(Connection *c)
+{
+    close(c->fd);
+    free(c->payload);
+    free(c->result);
+    free(c->out);
+    memset(c, 0, sizeof(*c));
+    c->fd = -1;
+}
+
+// Queue a complete request, or answer it here when it needs no worker;
+// returns -1 when the connection should be closed
+static int dispatch(Server *server, Connection *connections, int slot)
+{
+    Connection *c = &connections[slot];
+    char *payload = c->payload;
+    c->payload = NULL;
+    c->have = 0;
+
+    if (strncmp(payload, "STATS", 5) == 0)
+    {
+        char text[1024];
+        format_stats(server, text, sizeof(text));
+        free(payload);
+        return connection_reply(c, text);
+    }
+    if (strncmp(payload, "GEN", 3) != 0)
+    {
+        free(payload);
+        return connection_reply(c, "ERR unknown request, expected GEN or STATS");
+    }
+
+    pthread_mutex_lock(&server->lock);
+    int accepted = server->count < server->config->queue_size;
+    if (accepted)
+    {
+        Request *request = &server->queue[(server->head + server->count) % server->config->queue_size];
+        request->connection = slot;
+        request->payload = payload;
+        request->enqueued = now_seconds();
+        server->count++;
+        c->busy = 1;
+        pthread_cond_signal(&server->ready);
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    if (!accepted)
+    {
+        pthread_mutex_lock(&server->stats.lock);
+        server->stats.rejected++;
+        pthread_mutex_unlock(&server->stats.lock);
+        free(payload);
+        return connection_reply(c, "ERR server busy");
+    }
+    return 0;
+}
+
+// Read what is available; returns -1 when the connection should be closed
+static int connection_read(Server *server, Connection *connections, int slot)
+{
+    Connection *c = &connections[slot];
+    if (c->have < sizeof(c->header))
+    {
+        ssize_t n = recv(c->fd, c->header + c->have, sizeof(c->header) - c->have, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            return 0;
+        if (n <= 0)
+            return -1;
+        c->have += n;
+        if (c->have < sizeof(c->header))
+            return 0;
+
+        uint32_t length;
+        memcpy(&length, c->header, sizeof(length));
+        c->length = ntohl(length);
+        if (c->length > SERVER_MAX_MESSAGE)
+        {
+            // Close once the error has been sent
+            if (connection_reply(c, "ERR message too long") != 0 || c->out_length == 0)
+                return -1;
+            c->closing = 1;
+            return 0;
+        }
+        c->payload = (char *)malloc(c->length + 1);
+        if (!c->payload)
+            return -1;
+    }
+
+    uint32_t received = c->have - sizeof(c->header);
+    if (received < c->length)
+    {
+        ssize_t n = recv(c->fd, c->payload + received, c->length - received, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            return 0;
+        if (n <= 0)
+            return -1;
+        c->have += n;
+        received += n;
+    }
+    if (received == c->length)
+    {
+        c->payload[c->length] = '\0';
+        return dispatch(server, connections, slot);
+    }
+    return 0;
+}
+
+static void poll_loop(Server *server, int listen_fd)
+{
+    Connection *connections = server->connections;
+    struct pollfd *fds = (struct pollfd *)malloc((MAX_CONNECTIONS + 3) * sizeof(struct pollfd));
+    int *slots = (int *)malloc((MAX_CONNECTIONS + 3) * sizeof(int));
+    if (!fds || !slots)
+    {
+        fprintf(stderr, "Error: Unable to allocate memory for connections\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (;;)
+    {
+        int n = 0;
+        fds[n++] = (struct pollfd){signal_pipe[0], POLLIN, 0};
+        fds[n++] = (struct pollfd){server->wake[0], POLLIN, 0};
+        fds[n++] = (struct pollfd){listen_fd, POLLIN, 0};
+        for (int i = 0; i < MAX_CONNECTIONS; i++)
+        {
+            // Connections that are busy or still sending are not read, so each
+            // answers its requests in order and unread replies cannot pile up
+            Connection *c = &connections[i];
+            if (c->fd >= 0 && (c->out_length > 0 || !c->closing))
+            {
+                slots[n] = i;
+                fds[n++] = (struct pollfd){c->fd, c->out_length > 0 ? POLLOUT : c->busy ? 0 : POLLIN, 0};
+            }
+        }
+
+        if (poll(fds, n, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("Failed to poll");
+            break;
+        }
+        if (fds[0].revents)
+            break;
+
+        if (fds[1].revents & POLLIN)
+        {
+            int slot;
+            if (read(server->wake[0], &slot, sizeof(slot)) == sizeof(slot))
+            {
+                Connection *c = &connections[slot];
+                char *result = c->result;
+                c->result = NULL;
+                c->busy = 0;
+                int failed = connection_reply(c, result ? result : "ERR out of memory");
+                free(result);
+                if (failed || (c->closing && c->out_length == 0))
+                    connection_close(c);
+            }
+        }
+
+        if (fds[2].revents & POLLIN)
+        {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd >= 0)
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            int slot = 0;
+            while (fd >= 0 && slot < MAX_CONNECTIONS && connections[slot].fd >= 0)
+                slot++;
+            if (fd >= 0 && slot == MAX_CONNECTIONS)
+            {
+                server_send_message(fd, "ERR too many connections", 24); // Best effort, never blocks
+                close(fd);
+            }
+            else if (fd >= 0)
+                connections[slot].fd = fd;
+        }
+
+        for (int i = 3; i < n; i++)
+        {
+            Connection *c = &connections[slots[i]];
+            if (!fds[i].revents || c->fd < 0)
+                continue;
+            if (c->out_length > 0)
+            {
+                if (connection_flush(c) != 0 || (c->closing && c->out_length == 0))
+                    connection_close(c);
+            }
+            else if (c->busy)
+                c->closing = 1; // Hung up mid-request; close once the worker is done
+            else if (connection_read(server, connections, slots[i]) != 0)
+                connection_close(c);
+        }
+    }
+
+    // Stop the workers once the queue drains
+    pthread_mutex_lock(&server->lock);
+    server->shutdown = 1;
+    pthread_cond_broadcast(&server->ready);
+    pthread_mutex_unlock(&server->lock);
+    free(fds);
+    free(slots);
+}
+
+int server_run(const ServerConfig *config)
+{
+    if (config->workers < 1 || config->queue_size < 1 || config->max_length < 1)
+    {
+        fprintf(stderr, "Error: Invalid server options\n");
+        return -1;
+    }
+
+    Vocabulary *vocab = vocabulary_load(config->vocab_path);
+    if (!vocab)
+        return -1;
+    RNN *rnn = rnn_load(config->model_path);
+    if (rnn->output_size != vocab->size)
+    {
+        fprintf(stderr, "Error: Model expects %d words but vocabulary has %d\n", rnn->output_size, vocab->size);
+        rnn_free(rnn);
+        vocabulary_free(vocab);
+        return -1;
+    }
+    Bpe *bpe = NULL;
+    if (config->bpe_path)
+    {
+        bpe = bpe_load(config->bpe_path);
+        if (!bpe || bpe->num_tokens != vocab->size)
+        {
+            if (bpe)
+                fprintf(stderr, "Error: %s has %d tokens but the vocabulary has %d\n", config->bpe_path,
+                        bpe->num_tokens, vocab->size);
+            bpe_free(bpe);
+            rnn_free(rnn);
+            vocabulary_free(vocab);
+            return -1;
+        }
+    }
+    rnn_autotune(rnn, stdout);
+
+    Server server;
+    memset(&server, 0, sizeof(server));
+    server.config = config;
+    server.rnn = rnn;
+    server.vocab = vocab;
+    server.bpe = bpe;
+    server.wake[0] = server.wake[1] = -1;
+    server.queue = (Request *)malloc(config->queue_size * sizeof(Request));
+    server.connections = (Connection *)calloc(MAX_CONNECTIONS, sizeof(Connection));
+    for (int i = 0; server.connections && i < MAX_CONNECTIONS; i++)
+        server.connections[i].fd = -1;
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.ready, NULL);
+    pthread_mutex_init(&server.stats.lock, NULL);
+    server.stats.started = now_seconds();
+
+    pthread_t *workers = NULL;
+    int started = 0;
+    int status = -1;
+    int listen_fd = listen_socket(config);
+    if (!server.queue || !server.connections || listen_fd < 0 || pipe(server.wake) != 0 || pipe(signal_pipe) != 0)
+    {
+        fprintf(stderr, "Error: Unable to start the server\n");
+        goto cleanup;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    workers = (pthread_t *)malloc(config->workers * sizeof(pthread_t));
+    while (workers && started < config->workers && pthread_create(&workers[started], NULL, worker_main, &server) == 0)
+        started++;
+    if (started == 0)
+    {
+        fprintf(stderr, "Error: Unable to start server workers\n");
+        goto cleanup;
+    }
+
+    if (config->socket_path)
+        printf("Serving %s on %s with %d workers\n", config->model_path, config->socket_path, started);
+    else
+        printf("Serving %s on 127.0.0.1:%d with %d workers\n", config->model_path, config->port, started);
+    fflush(stdout);
+
+    poll_loop(&server, listen_fd);
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+    printf("Server stopped after %ld requests\n", server.stats.requests);
+    status = 0;
+
+cleanup:
+    for (int i = 0; server.connections && i < MAX_CONNECTIONS; i++)
+    {
+        if (server.connections[i].fd >= 0)
+            connection_close(&server.connections[i]);
+    }
+    if (listen_fd >= 0)
+    {
+        close(listen_fd);
+        if (config->socket_path)
+            unlink(config->socket_path);
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        if (server.wake[i] >= 0)
+            close(server.wake[i]);
+        if (signal_pipe[i] >= 0)
+            close(signal_pipe[i]);
+        signal_pipe[i] = -1;
+    }
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    free(workers);
+    free(server.queue);
+    free(server.connections);
+    pthread_mutex_destroy(&server.lock);
+    pthread_cond_destroy(&server.ready);
+    pthread_mutex_destroy(&server.stats.lock);
+    bpe_free(bpe);
+    rnn_free(rnn);
+    vocabulary_free(vocab);
+    return status;
+}
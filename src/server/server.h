@@ -0,0 +1,31 @@
+#pragma once
+#include <stdint.h>
+
+// Every message in either direction is a 4-byte big-endian payload length
+// followed by the payload. Requests are text:
+//   GEN <length> <prompt words...>  ->  "OK <generated words>" or "ERR <reason>"
+//     (with BPE merges loaded the prompt is text, and the reply is the decoded text)
+//   STATS                           ->  "OK key=value ..." latency and throughput counters
+#define SERVER_MAX_MESSAGE (64 * 1024)
+
+typedef struct
+{
+    const char *model_path;
+    const char *vocab_path;
+    const char *bpe_path;    // Merges of a BPE-trained model, or NULL for word tokens
+    const char *socket_path; // Unix-domain socket to listen on, or NULL for TCP
+    int port;                // Localhost TCP port when socket_path is NULL
+    int workers;             // Generation threads
+    int queue_size;          // Requests waiting for a worker before new ones are refused
+    int max_length;          // Longest generation one request may ask for
+} ServerConfig;
+
+// Load the model once and serve requests until SIGINT or SIGTERM. Each
+// request runs on a worker thread with its own hidden state, starting from
+// the state saved with the model. Returns 0 on a clean shutdown.
+int server_run(const ServerConfig *config);
+
+// Client side: "host:port" for TCP, anything else is a Unix socket path
+int server_connect(const char *address);
+int server_send_message(int fd, const char *data, uint32_t length);
+char *server_recv_message(int fd, uint32_t *length); // NUL terminated, NULL on EOF or error
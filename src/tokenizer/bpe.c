@@ -0,0 +1,731 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "bpe.h"
+
+typedef struct
+{
+    int32_t *symbols;
+    int length;
+    int64_t count; // Occurrences of this word in the corpus
+    int stamp;     // Last merge that rewrote this word
+} BpeWord;
+
+// Running count of a pair plus the words it may occur in. The word list
+// only ever grows; stale entries are skipped when the pair is merged.
+typedef struct
+{
+    uint64_t key; // 0 marks an empty slot
+    int64_t count;
+    int32_t *words;
+    int num_words;
+    int words_capacity;
+    int stamp; // Last merge that touched this pair
+} BpePairStat;
+
+typedef struct
+{
+    BpePairStat *slots;
+    size_t capacity;
+    size_t size;
+} BpePairTable;
+
+typedef struct
+{
+    int64_t count;
+    uint64_t key;
+} BpeHeapEntry;
+
+typedef struct
+{
+    BpeHeapEntry *entries;
+    size_t size;
+    size_t capacity;
+} BpeHeap;
+
+static void *bpe_alloc(size_t size)
+{
+    void *p = malloc(size);
+    if (!p)
+    {
+        fprintf(stderr, "Error: Unable to allocate memory for BPE tokenizer\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static void *bpe_realloc(void *p, size_t size)
+{
+    p = realloc(p, size);
+    if (!p)
+    {
+        fprintf(stderr, "Error: Unable to allocate memory for BPE tokenizer\n");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static uint64_t pair_key(int32_t left, int32_t right)
+{
+    return (((uint64_t)(uint32_t)left << 32) | (uint32_t)right) + 1;
+}
+
+static size_t hash_key(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    return (size_t)key;
+}
+
+// Merge rank table
+
+static void rank_table_init(BpeRankTable *t, int num_merges)
+{
+    t->capacity = 16;
+    while (t->capacity < (size_t)num_merges * 2)
+        t->capacity *= 2;
+    t->keys = (uint64_t *)calloc(t->capacity, sizeof(uint64_t));
+    t->ranks = (int32_t *)bpe_alloc(t->capacity * sizeof(int32_t));
+    if (!t->keys)
+    {
+        fprintf(stderr, "Error: Unable to allocate memory for BPE tokenizer\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void rank_table_put(BpeRankTable *t, uint64_t key, int32_t rank)
+{
+    size_t i = hash_key(key) & (t->capacity - 1);
+    while (t->keys[i] && t->keys[i] != key)
+        i = (i + 1) & (t->capacity - 1);
+    t->keys[i] = key;
+    t->ranks[i] = rank;
+}
+
+static int32_t rank_table_get(const BpeRankTable *t, uint64_t key)
+{
+    size_t i = hash_key(key) & (t->capacity - 1);
+    while (t->keys[i])
+    {
+        if (t->keys[i] == key)
+            return t->ranks[i];
+        i = (i + 1) & (t->capacity - 1);
+    }
+    return -1;
+}
+
+// Pair statistics used during training
+
+static BpePairStat *pair_table_find(BpePairTable *t, uint64_t key, int create)
+{
+    if (create && (t->size + 1) * 2 > t->capacity)
+    {
+        BpePairStat *old = t->slots;
+        size_t old_capacity = t->capacity;
+        t->capacity = old_capacity ? old_capacity * 2 : 1024;
+        t->slots = (BpePairStat *)calloc(t->capacity, sizeof(BpePairStat));
+        if (!t->slots)
+        {
+            fprintf(stderr, "Error: Unable to allocate memory for BPE tokenizer\n");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < old_capacity; i++)
+        {
+            if (!old[i].key)
+                continue;
+            size_t j = hash_key(old[i].key) & (t->capacity - 1);
+            while (t->slots[j].key)
+                j = (j + 1) & (t->capacity - 1);
+            t->slots[j] = old[i];
+        }
+        free(old);
+    }
+    if (!t->capacity)
+        return NULL;
+
+    size_t i = hash_key(key) & (t->capacity - 1);
+    while (t->slots[i].key)
+    {
+        if (t->slots[i].key == key)
+            return &t->slots[i];
+        i = (i + 1) & (t->capacity - 1);
+    }
+    if (!create)
+        return NULL;
+
+    t->slots[i].key = key;
+    t->slots[i].stamp = -1;
+    t->size++;
+    return &t->slots[i];
+}
+
+static void heap_push(BpeHeap *h, int64_t count, uint64_t key)
+{
+    if (h->size == h->capacity)
+    {
+        h->capacity = h->capacity ? h->capacity * 2 : 1024;
+        h->entries = (BpeHeapEntry *)bpe_realloc(h->entries, h->capacity * sizeof(BpeHeapEntry));
+    }
+    // Higher counts first, ties broken towards the smaller pair for determinism
+    size_t i = h->size++;
+    while (i > 0)
+    {
+        size_t parent = (i - 1) / 2;
+        BpeHeapEntry *p = &h->entries[parent];
+        if (p->count > count || (p->count == count && p->key < key))
+            break;
+        h->entries[i] = *p;
+        i = parent;
+    }
+    h->entries[i].count = count;
+    h->entries[i].key = key;
+}
+
+static BpeHeapEntry heap_pop(BpeHeap *h)
+{
+    BpeHeapEntry top = h->entries[0];
+    BpeHeapEntry last = h->entries[--h->size];
+    size_t i = 0;
+    for (;;)
+    {
+        size_t child = 2 * i + 1;
+        if (child >= h->size)
+            break;
+        BpeHeapEntry *c = &h->entries[child];
+        if (child + 1 < h->size)
+        {
+            BpeHeapEntry *r = &h->entries[child + 1];
+            if (r->count > c->count || (r->count == c->count && r->key < c->key))
+                c = r, child++;
+        }
+        if (last.count > c->count || (last.count == c->count && last.key < c->key))
+            break;
+        h->entries[i] = *c;
+        i = child;
+    }
+    if (h->size)
+        h->entries[i] = last;
+    return top;
+}
+
+typedef struct
+{
+    BpePairTable pairs;
+    BpeHeap heap;
+    uint64_t *touched; // Pairs whose count changed during the current merge
+    size_t num_touched;
+    size_t touched_capacity;
+    int stamp;
+} BpeTrainer;
+
+static void trainer_add(BpeTrainer *tr, int32_t left, int32_t right, int64_t delta, int word)
+{
+    uint64_t key = pair_key(left, right);
+    BpePairStat *s = pair_table_find(&tr->pairs, key, 1);
+    s->count += delta;
+
+    if (delta > 0 && (s->num_words == 0 || s->words[s->num_words - 1] != word))
+    {
+        if (s->num_words == s->words_capacity)
+        {
+            s->words_capacity = s->words_capacity ? s->words_capacity * 2 : 4;
+            s->words = (int32_t *)bpe_realloc(s->words, s->words_capacity * sizeof(int32_t));
+        }
+        s->words[s->num_words++] = word;
+    }
+
+    if (s->stamp != tr->stamp)
+    {
+        s->stamp = tr->stamp;
+        if (tr->num_touched == tr->touched_capacity)
+        {
+            tr->touched_capacity = tr->touched_capacity ? tr->touched_capacity * 2 : 256;
+            tr->touched = (uint64_t *)bpe_realloc(tr->touched, tr->touched_capacity * sizeof(uint64_t));
+        }
+        tr->touched[tr->num_touched++] = key;
+    }
+}
+
+// Push the new counts of all pairs touched by a merge onto the heap
+static void trainer_flush(BpeTrainer *tr)
+{
+    for (size_t i = 0; i < tr->num_touched; i++)
+    {
+        BpePairStat *s = pair_table_find(&tr->pairs, tr->touched[i], 0);
+        if (s->count > 0)
+            heap_push(&tr->heap, s->count, s->key);
+    }
+    tr->num_touched = 0;
+}
+
+// Collect distinct whitespace separated words, each prefixed with a space
+static BpeWord *collect_words(const char *text, int *num_words)
+{
+    size_t capacity = 1024;
+    BpeWord *words = (BpeWord *)bpe_alloc(capacity * sizeof(BpeWord));
+    int count = 0;
+
+    size_t index_capacity = 2048;
+    int32_t *index = (int32_t *)bpe_alloc(index_capacity * sizeof(int32_t));
+    memset(index, -1, index_capacity * sizeof(int32_t));
+
+    const char *p = text;
+    while (*p)
+    {
+        if (isspace((unsigned char)*p))
+        {
+            p++;
+            continue;
+        }
+        const char *start = p;
+        while (*p && !isspace((unsigned char)*p))
+            p++;
+        int length = (int)(p - start) + 1;
+
+        // Look the word up by its bytes (including the space prefix)
+        uint64_t h = 0xcbf29ce484222325ull ^ ' ';
+        h *= 0x100000001b3ull;
+        for (const char *c = start; c < p; c++)
+        {
+            h ^= (unsigned char)*c;
+            h *= 0x100000001b3ull;
+        }
+        size_t slot = hash_key(h) & (index_capacity - 1);
+        int found = -1;
+        while (index[slot] != -1)
+        {
+            BpeWord *w = &words[index[slot]];
+            if (w->length == length)
+            {
+                int same = 1;
+                for (int k = 1; k < length && same; k++)
+                    same = w->symbols[k] == BPE_BYTE_BASE + (unsigned char)start[k - 1];
+                if (same)
+                {
+                    found = index[slot];
+                    break;
+                }
+            }
+            slot = (slot + 1) & (index_capacity - 1);
+        }
+        if (found != -1)
+        {
+            words[found].count++;
+            continue;
+        }
+
+        if ((size_t)count == capacity)
+        {
+            capacity *= 2;
+            words = (BpeWord *)bpe_realloc(words, capacity * sizeof(BpeWord));
+        }
+        BpeWord *w = &words[count];
+        w->symbols = (int32_t *)bpe_alloc(length * sizeof(int32_t));
+        w->symbols[0] = BPE_BYTE_BASE + ' ';
+        for (int k = 1; k < length; k++)
+            w->symbols[k] = BPE_BYTE_BASE + (unsigned char)start[k - 1];
+        w->length = length;
+        w->count = 1;
+        w->stamp = -1;
+        index[slot] = count++;
+
+        // Keep the index at most half full
+        if ((size_t)count * 2 > index_capacity)
+        {
+            free(index);
+            index_capacity *= 2;
+            index = (int32_t *)bpe_alloc(index_capacity * sizeof(int32_t));
+            memset(index, -1, index_capacity * sizeof(int32_t));
+            for (int i = 0; i < count; i++)
+            {
+                uint64_t wh = 0xcbf29ce484222325ull;
+                for (int k = 0; k < words[i].length; k++)
+                {
+                    wh ^= (unsigned char)(words[i].symbols[k] - BPE_BYTE_BASE);
+                    wh *= 0x100000001b3ull;
+                }
+                size_t s = hash_key(wh) & (index_capacity - 1);
+                while (index[s] != -1)
+                    s = (s + 1) & (index_capacity - 1);
+                index[s] = i;
+            }
+        }
+    }
+
+    free(index);
+    *num_words = count;
+    return words;
+}
+
+// Build the byte strings of all tokens from the merge list
+static void build_tokens(Bpe *bpe)
+{
+    bpe->num_tokens = BPE_MERGE_BASE + bpe->num_merges;
+    bpe->offsets = (uint32_t *)bpe_alloc(bpe->num_tokens * sizeof(uint32_t));
+    bpe->lengths = (uint32_t *)bpe_alloc(bpe->num_tokens * sizeof(uint32_t));
+
+    size_t pool_size = 256;
+    for (int id = 0; id < BPE_BYTE_BASE; id++)
+        bpe->lengths[id] = 0;
+    for (int b = 0; b < 256; b++)
+        bpe->lengths[BPE_BYTE_BASE + b] = 1;
+    for (int r = 0; r < bpe->num_merges; r++)
+    {
+        bpe->lengths[BPE_MERGE_BASE + r] = bpe->lengths[bpe->merges[r].left] + bpe->lengths[bpe->merges[r].right];
+        pool_size += bpe->lengths[BPE_MERGE_BASE + r];
+    }
+
+    bpe->pool = (char *)bpe_alloc(pool_size);
+    size_t offset = 0;
+    for (int id = 0; id < BPE_BYTE_BASE; id++)
+        bpe->offsets[id] = 0;
+    for (int b = 0; b < 256; b++)
+    {
+        bpe->offsets[BPE_BYTE_BASE + b] = (uint32_t)offset;
+        bpe->pool[offset++] = (char)b;
+    }
+    for (int r = 0; r < bpe->num_merges; r++)
+    {
+        BpePair m = bpe->merges[r];
+        bpe->offsets[BPE_MERGE_BASE + r] = (uint32_t)offset;
+        memcpy(bpe->pool + offset, bpe->pool + bpe->offsets[m.left], bpe->lengths[m.left]);
+        offset += bpe->lengths[m.left];
+        memcpy(bpe->pool + offset, bpe->pool + bpe->offsets[m.right], bpe->lengths[m.right]);
+        offset += bpe->lengths[m.right];
+    }
+
+    rank_table_init(&bpe->ranks, bpe->num_merges);
+    for (int r = 0; r < bpe->num_merges; r++)
+        rank_table_put(&bpe->ranks, pair_key(bpe->merges[r].left, bpe->merges[r].right), r);
+}
+
+// Learn merges until the vocabulary (special + byte + merged tokens) reaches
+// vocab_size or no pair occurs more than once
+Bpe *bpe_train(const char *text, int vocab_size)
+{
+    Bpe *bpe = (Bpe *)calloc(1, sizeof(Bpe));
+    if (!bpe)
+        return NULL;
+
+    int max_merges = vocab_size > BPE_MERGE_BASE ? vocab_size - BPE_MERGE_BASE : 0;
+    bpe->merges = (BpePair *)bpe_alloc((max_merges ? max_merges : 1) * sizeof(BpePair));
+
+    int num_words;
+    BpeWord *words = collect_words(text, &num_words);
+
+    BpeTrainer tr;
+    memset(&tr, 0, sizeof(tr));
+    for (int w = 0; w < num_words; w++)
+    {
+        for (int k = 0; k + 1 < words[w].length; k++)
+            trainer_add(&tr, words[w].symbols[k], words[w].symbols[k + 1], words[w].count, w);
+    }
+    trainer_flush(&tr);
+
+    while (bpe->num_merges < max_merges && tr.heap.size > 0)
+    {
+        BpeHeapEntry best = heap_pop(&tr.heap);
+        BpePairStat *s = pair_table_find(&tr.pairs, best.key, 0);
+        if (s->count != best.count)
+            continue; // Stale entry, a fresher one is in the heap
+        if (best.count < 2)
+            break;
+
+        int rank = bpe->num_merges;
+        int32_t left = (int32_t)((best.key - 1) >> 32);
+        int32_t right = (int32_t)((best.key - 1) & 0xffffffffu);
+        int32_t merged = BPE_MERGE_BASE + rank;
+        bpe->merges[rank].left = left;
+        bpe->merges[rank].right = right;
+        bpe->num_merges++;
+        tr.stamp = rank;
+
+        // Take the word list: rewriting words may grow the pair table
+        int32_t *occurrences = s->words;
+        int num_occurrences = s->num_words;
+        s->words = NULL;
+        s->num_words = s->words_capacity = 0;
+
+        for (int o = 0; o < num_occurrences; o++)
+        {
+            BpeWord *w = &words[occurrences[o]];
+            if (w->stamp == rank)
+                continue;
+            w->stamp = rank;
+
+            int32_t *sym = w->symbols;
+            int k = 0;
+            while (k + 1 < w->length)
+            {
+                if (sym[k] != left || sym[k + 1] != right)
+                {
+                    k++;
+                    continue;
+                }
+                if (k > 0)
+                {
+                    trainer_add(&tr, sym[k - 1], left, -w->count, occurrences[o]);
+                    trainer_add(&tr, sym[k - 1], merged, w->count, occurrences[o]);
+                }
+                if (k + 2 < w->length)
+                {
+                    trainer_add(&tr, right, sym[k + 2], -w->count, occurrences[o]);
+                    trainer_add(&tr, merged, sym[k + 2], w->count, occurrences[o]);
+                }
+                trainer_add(&tr, left, right, -w->count, occurrences[o]);
+                sym[k] = merged;
+                memmove(&sym[k + 1], &sym[k + 2], (w->length - k - 2) * sizeof(int32_t));
+                w->length--;
+                k++;
+            }
+        }
+        free(occurrences);
+        trainer_flush(&tr);
+    }
+
+    for (int w = 0; w < num_words; w++)
+        free(words[w].symbols);
+    free(words);
+    for (size_t i = 0; i < tr.pairs.capacity; i++)
+        free(tr.pairs.slots[i].words);
+    free(tr.pairs.slots);
+    free(tr.heap.entries);
+    free(tr.touched);
+
+    build_tokens(bpe);
+    return bpe;
+}
+
+void bpe_free(Bpe *bpe)
+{
+    if (bpe)
+    {
+        free(bpe->merges);
+        free(bpe->ranks.keys);
+        free(bpe->ranks.ranks);
+        free(bpe->pool);
+        free(bpe->offsets);
+        free(bpe->lengths);
+        free(bpe);
+    }
+}
+
+int bpe_save(const Bpe *bpe, const char *filename)
+{
+    FILE *file = fopen(filename, "wb");
+    if (!file)
+    {
+        fprintf(stderr, "Error: Unable to open file for saving BPE merges\n");
+        return -1;
+    }
+
+    uint32_t header[4] = {BPE_MAGIC, BPE_VERSION, (uint32_t)bpe->num_merges, 0};
+    int ok = fwrite(header, sizeof(header), 1, file) == 1 &&
+             fwrite(bpe->merges, sizeof(BpePair), bpe->num_merges, file) == (size_t)bpe->num_merges;
+
+    if (fclose(file) != 0 || !ok)
+    {
+        fprintf(stderr, "Error: Failed to write BPE merges to %s\n", filename);
+        return -1;
+    }
+    return 0;
+}
+
+Bpe *bpe_load(const char *filename)
+{
+    FILE *file = fopen(filename, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "Error: Unable to open file for loading BPE merges\n");
+        return NULL;
+    }
+
+    uint32_t header[4];
+    if (fread(header, sizeof(header), 1, file) != 1 || header[0] != BPE_MAGIC || header[1] != BPE_VERSION)
+    {
+        fprintf(stderr, "Error: %s is not a valid BPE merges file\n", filename);
+        fclose(file);
+        return NULL;
+    }
+
+    Bpe *bpe = (Bpe *)calloc(1, sizeof(Bpe));
+    if (!bpe)
+    {
+        fclose(file);
+        return NULL;
+    }
+    bpe->num_merges = (int)header[2];
+    bpe->merges = (BpePair *)bpe_alloc((bpe->num_merges ? bpe->num_merges : 1) * sizeof(BpePair));
+    int ok = fread(bpe->merges, sizeof(BpePair), bpe->num_merges, file) == (size_t)bpe->num_merges;
+    fclose(file);
+
+    // Every merge may only refer to tokens that exist before it
+    for (int r = 0; ok && r < bpe->num_merges; r++)
+    {
+        BpePair m = bpe->merges[r];
+        ok = m.left >= BPE_BYTE_BASE && m.right >= BPE_BYTE_BASE &&
+             m.left < BPE_MERGE_BASE + r && m.right < BPE_MERGE_BASE + r;
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "Error: %s is corrupted\n", filename);
+        free(bpe->merges);
+        free(bpe);
+        return NULL;
+    }
+
+    build_tokens(bpe);
+    return bpe;
+}
+
+// Encode one pre-tokenized word into out (room for length ids); returns the
+// number of tokens. Unseen bytes fall back to their byte tokens.
+int bpe_encode_word(const Bpe *bpe, const char *word, size_t length, uint32_t *out)
+{
+    int n = (int)length;
+    for (int k = 0; k < n; k++)
+        out[k] = BPE_BYTE_BASE + (unsigned char)word[k];
+
+    // Apply the lowest ranked merge present until none applies, matching training order
+    for (;;)
+    {
+        int32_t best_rank = -1;
+        for (int k = 0; k + 1 < n; k++)
+        {
+            int32_t rank = rank_table_get(&bpe->ranks, pair_key(out[k], out[k + 1]));
+            if (rank != -1 && (best_rank == -1 || rank < best_rank))
+                best_rank = rank;
+        }
+        if (best_rank == -1)
+            break;
+
+        BpePair m = bpe->merges[best_rank];
+        int j = 0;
+        for (int k = 0; k < n; k++)
+        {
+            if (k + 1 < n && out[k] == (uint32_t)m.left && out[k + 1] == (uint32_t)m.right)
+            {
+                out[j++] = BPE_MERGE_BASE + best_rank;
+                k++;
+            }
+            else
+            {
+                out[j++] = out[k];
+            }
+        }
+        n = j;
+    }
+    return n;
+}
+
+// Same segmentation as dataset_tokenize: one sentence per line, <eos> after each
+uint32_t *bpe_tokenize(const Bpe *bpe, const char *text, size_t *num_tokens)
+{
+    // A word of n bytes gives at most n + 1 tokens (space prefix, then one per
+    // byte), and every <eos> but the last one consumes a newline
+    size_t text_length = strlen(text);
+    size_t capacity = 2 * text_length + 2;
+    uint32_t *tokens = (uint32_t *)bpe_alloc(capacity * sizeof(uint32_t));
+    char *word = (char *)bpe_alloc(text_length + 2);
+    size_t count = 0;
+    int line_has_words = 0;
+
+    const char *p = text;
+    while (*p)
+    {
+        if (*p == '\n')
+        {
+            p++;
+            if (line_has_words)
+                tokens[count++] = VOCAB_EOS;
+            line_has_words = 0;
+            continue;
+        }
+        if (isspace((unsigned char)*p))
+        {
+            p++;
+            continue;
+        }
+
+        size_t length = 0;
+        word[length++] = ' ';
+        while (*p && !isspace((unsigned char)*p))
+            word[length++] = *p++;
+        count += bpe_encode_word(bpe, word, length, tokens + count);
+        line_has_words = 1;
+    }
+    if (line_has_words)
+        tokens[count++] = VOCAB_EOS;
+
+    free(word);
+    *num_tokens = count;
+    return tokens;
+}
+
+char *bpe_decode(const Bpe *bpe, const uint32_t *ids, size_t num_ids)
+{
+    size_t length = 0;
+    for (size_t i = 0; i < num_ids; i++)
+        length += ids[i] < (uint32_t)bpe->num_tokens ? bpe->lengths[ids[i]] + 1 : 0;
+
+    char *text = (char *)bpe_alloc(length + 1);
+    size_t n = 0;
+    int line_start = 1;
+    for (size_t i = 0; i < num_ids; i++)
+    {
+        if (ids[i] == VOCAB_EOS)
+        {
+            text[n++] = '\n';
+            line_start = 1;
+            continue;
+        }
+        if (ids[i] < BPE_BYTE_BASE || ids[i] >= (uint32_t)bpe->num_tokens)
+            continue;
+
+        const char *bytes = bpe->pool + bpe->offsets[ids[i]];
+        uint32_t count = bpe->lengths[ids[i]];
+        // Drop the word separator in front of the first word of a line
+        if (line_start && count > 0 && bytes[0] == ' ')
+            bytes++, count--;
+        memcpy(text + n, bytes, count);
+        n += count;
+        line_start = 0;
+    }
+    text[n] = '\0';
+    return text;
+}
+
+// Token bytes become vocabulary words. NUL bytes and tokens that clash with
+// an existing word get a unique placeholder so ids stay aligned.
+Vocabulary *bpe_build_vocabulary(const Bpe *bpe)
+{
+    Vocabulary *v = vocabulary_create(bpe->num_tokens - VOCAB_SPECIAL_COUNT);
+    if (!v)
+        return NULL;
+
+    uint32_t max_length = 0;
+    for (int id = 0; id < bpe->num_tokens; id++)
+        max_length = bpe->lengths[id] > max_length ? bpe->lengths[id] : max_length;
+    char *word = (char *)bpe_alloc(max_length + 32);
+
+    for (int id = BPE_BYTE_BASE; id < bpe->num_tokens; id++)
+    {
+        memcpy(word, bpe->pool + bpe->offsets[id], bpe->lengths[id]);
+        word[bpe->lengths[id]] = '\0';
+        if (memchr(word, '\0', bpe->lengths[id]) || vocabulary_get_index(v, word) != -1)
+            snprintf(word, max_length + 32, "<bpe:%d>", id);
+        if (vocabulary_add_word(v, word) != id)
+        {
+            fprintf(stderr, "Error: Unable to add BPE token %d to the vocabulary\n", id);
+            free(word);
+            vocabulary_free(v);
+            return NULL;
+        }
+    }
+
+    free(word);
+    return v;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include "../vocabulary/vocabulary.h"
+
+#define BPE_MAGIC 0x424E4E52u // "RNNB" in little-endian byte order
+#define BPE_VERSION 1
+
+// Token ids line up with the vocabulary: the special tokens come first,
+// then one token per byte value, then one token per learned merge.
+#define BPE_BYTE_BASE VOCAB_SPECIAL_COUNT
+#define BPE_MERGE_BASE (BPE_BYTE_BASE + 256)
+
+typedef struct
+{
+    int32_t left;
+    int32_t right;
+} BpePair;
+
+// Open addressing map from a token pair to its merge rank
+typedef struct
+{
+    uint64_t *keys; // (left << 32 | right) + 1, 0 marks an empty slot
+    int32_t *ranks;
+    size_t capacity;
+} BpeRankTable;
+
+typedef struct
+{
+    BpePair *merges;    // merges[r] creates token BPE_MERGE_BASE + r
+    int num_merges;
+    BpeRankTable ranks; // Pair -> merge rank, used for encoding
+    char *pool;         // Bytes of every token back to back
+    uint32_t *offsets;  // Start of each token's bytes in pool
+    uint32_t *lengths;  // Number of bytes of each token
+    int num_tokens;     // BPE_MERGE_BASE + num_merges
+} Bpe;
+
+// Training and persistence
+Bpe *bpe_train(const char *text, int vocab_size);
+void bpe_free(Bpe *bpe);
+int bpe_save(const Bpe *bpe, const char *filename);
+Bpe *bpe_load(const char *filename);
+
+// Encoding and decoding
+int bpe_encode_word(const Bpe *bpe, const char *word, size_t length, uint32_t *out);
+uint32_t *bpe_tokenize(const Bpe *bpe, const char *text, size_t *num_tokens);
+char *bpe_decode(const Bpe *bpe, const uint32_t *ids, size_t num_ids);
+
+// Vocabulary whose ids match the BPE token ids
+Vocabulary *bpe_build_vocabulary(const Bpe *bpe);
@@ -2,6 +2,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 unsigned int hash_word(const char *word)
 {
@@ -15,19 +19,24 @@ unsigned int hash_word(const char *word)
 
 Vocabulary *vocabulary_create(int initial_capacity)
 {
-    Vocabulary *v = (Vocabulary *)malloc(sizeof(Vocabulary));
+    Vocabulary *v = (Vocabulary *)calloc(1, sizeof(Vocabulary));
     if (!v)
         return NULL; // Memory allocation failure
 
     initial_capacity += VOCAB_SPECIAL_COUNT;
 
-    v->table = (VocabularyEntry **)calloc(initial_capacity, sizeof(VocabularyEntry *));
-    if (!v->table)
+    v->pool_capacity = (size_t)initial_capacity * 8;
+    v->pool = (char *)malloc(v->pool_capacity);
+    v->offsets = (uint32_t *)malloc(initial_capacity * sizeof(uint32_t));
+    v->buckets = (int32_t *)malloc(initial_capacity * sizeof(int32_t));
+    v->next = (int32_t *)malloc(initial_capacity * sizeof(int32_t));
+    if (!v->pool || !v->offsets || !v->buckets || !v->next)
     {
         perror("Failed to allocate memory for hash table");
-        free(v);
+        vocabulary_free(v);
         return NULL; // Memory allocation failure
     }
+    memset(v->buckets, -1, initial_capacity * sizeof(int32_t));
     v->size = 0;
     v->capacity = initial_capacity;
 
@@ -44,60 +53,132 @@ void vocabulary_free(Vocabulary *v)
 {
     if (!v)
         return;
-    for (int i = 0; i < v->capacity; i++)
+    if (v->mapping)
     {
-        VocabularyEntry *entry = v->table[i];
-        while (entry)
-        {
-            VocabularyEntry *next = entry->next;
-            free(entry->word);
-            free(entry);
-            entry = next;
-        }
+        munmap(v->mapping, v->mapping_size);
+    }
+    else
+    {
+        free(v->pool);
+        free(v->offsets);
+        free(v->buckets);
+        free(v->next);
     }
-    free(v->table);
     free(v);
 }
 
-int vocabulary_add_word(Vocabulary *v, const char *word)
+// Copy a mapped vocabulary to the heap so it can be modified
+static int vocabulary_detach(Vocabulary *v)
 {
-    if (v->size == v->capacity)
+    char *pool = (char *)malloc(v->pool_size);
+    uint32_t *offsets = (uint32_t *)malloc(v->capacity * sizeof(uint32_t));
+    int32_t *buckets = (int32_t *)malloc(v->capacity * sizeof(int32_t));
+    int32_t *next = (int32_t *)malloc(v->capacity * sizeof(int32_t));
+    if (!pool || !offsets || !buckets || !next)
     {
-        perror("Vocabulary already full");
-        return -1; // Vocabulary full
+        perror("Failed to allocate memory for vocabulary");
+        free(pool);
+        free(offsets);
+        free(buckets);
+        free(next);
+        return -1;
+    }
+    memcpy(pool, v->pool, v->pool_size);
+    memcpy(offsets, v->offsets, v->size * sizeof(uint32_t));
+    memcpy(buckets, v->buckets, v->capacity * sizeof(int32_t));
+    memcpy(next, v->next, v->size * sizeof(int32_t));
+
+    munmap(v->mapping, v->mapping_size);
+    v->mapping = NULL;
+    v->mapping_size = 0;
+    v->pool = pool;
+    v->pool_capacity = v->pool_size;
+    v->offsets = offsets;
+    v->buckets = buckets;
+    v->next = next;
+    return 0;
+}
+
+int vocabulary_reserve(Vocabulary *v, int capacity)
+{
+    if (capacity <= v->capacity)
+        return 0;
+    if (v->mapping && vocabulary_detach(v) != 0)
+        return -1;
+
+    uint32_t *offsets = (uint32_t *)realloc(v->offsets, capacity * sizeof(uint32_t));
+    if (offsets)
+        v->offsets = offsets;
+    int32_t *next = (int32_t *)realloc(v->next, capacity * sizeof(int32_t));
+    if (next)
+        v->next = next;
+    int32_t *buckets = (int32_t *)malloc(capacity * sizeof(int32_t));
+    if (!offsets || !next || !buckets)
+    {
+        perror("Failed to allocate memory for vocabulary");
+        free(buckets);
+        return -1;
+    }
+
+    // The bucket count is the capacity, so every word moves to a new chain
+    memset(buckets, -1, capacity * sizeof(int32_t));
+    for (int id = 0; id < v->size; id++)
+    {
+        unsigned int hash = hash_word(v->pool + v->offsets[id]) % capacity;
+        v->next[id] = buckets[hash];
+        buckets[hash] = id;
     }
+    free(v->buckets);
+    v->buckets = buckets;
+    v->capacity = capacity;
+    return 0;
+}
+
+int vocabulary_add_word(Vocabulary *v, const char *word)
+{
     unsigned int hash = hash_word(word) % v->capacity;
-    VocabularyEntry *entry = v->table[hash];
-    while (entry)
+    for (int32_t id = v->buckets[hash]; id != -1; id = v->next[id])
     {
-        if (strcmp(entry->word, word) == 0)
+        if (strcmp(v->pool + v->offsets[id], word) == 0)
         {
-            return entry->id;
+            return id;
         }
-        entry = entry->next;
     }
 
-    VocabularyEntry *new_entry = (VocabularyEntry *)malloc(sizeof(VocabularyEntry));
-    if (!new_entry)
+    if (v->size == v->capacity)
     {
-        perror("Failed to allocate memory for new entry");
-        return -1; // Memory allocation failure
+        perror("Vocabulary already full");
+        return -1; // Vocabulary full
     }
+    if (v->mapping && vocabulary_detach(v) != 0)
+        return -1;
 
-    new_entry->word = strdup(word);
-    if (!new_entry->word)
+    size_t length = strlen(word) + 1;
+    if (v->pool_size + length > v->pool_capacity)
     {
-        perror("Failed to allocate memory for word");
-        free(new_entry); // Free the entry structure
-        return -1;
+        size_t new_capacity = v->pool_capacity * 2;
+        while (new_capacity < v->pool_size + length)
+            new_capacity *= 2;
+        char *pool = (char *)realloc(v->pool, new_capacity);
+        if (!pool)
+        {
+            perror("Failed to allocate memory for word");
+            return -1;
+        }
+        v->pool = pool;
+        v->pool_capacity = new_capacity;
     }
 
-    new_entry->id = v->size;
-    new_entry->next = v->table[hash];
-    v->table[hash] = new_entry;
+    int id = v->size;
+    memcpy(v->pool + v->pool_size, word, length);
+    v->offsets[id] = (uint32_t)v->pool_size;
+    v->pool_size += length;
+
+    v->next[id] = v->buckets[hash];
+    v->buckets[hash] = id;
 
     v->size++;
-    return new_entry->id;
+    return id;
 }
 
 int vocabulary_get_index(const Vocabulary *v, const char *word)
@@ -106,30 +187,20 @@ int vocabulary_get_index(const Vocabulary *v, const char *word)
         return -1;
 
     unsigned int hash = hash_word(word) % v->capacity;
-    VocabularyEntry *entry = v->table[hash];
-
-    while (entry)
+    for (int32_t id = v->buckets[hash]; id != -1; id = v->next[id])
     {
-        if (strcmp(entry->word, word) == 0)
+        if (strcmp(v->pool + v->offsets[id], word) == 0)
         {
-            return entry->id;
+            return id;
         }
-        entry = entry->next;
     }
     return -1; // Word not found
 }
 
 char *vocabulary_get_word(Vocabulary *v, int index) {
-    for (int i = 0; i < v->capacity; i++) {
-        VocabularyEntry *entry = v->table[i];
-        while (entry) {
-            if (entry->id == index) {
-                return entry->word;
-            }
-            entry = entry->next;
-        }
-    }
-    return NULL; // Word not found
+    if (index < 0 || index >= v->size)
+        return NULL; // Word not found
+    return v->pool + v->offsets[index];
 }
 
 
@@ -141,15 +212,28 @@ void vocabulary_print(const Vocabulary *v)
         return;
     }
 
-    for (int i = 0; i < v->capacity; i++)
+    for (int id = 0; id < v->size; id++)
+    {
+        printf("Word: %s, ID: %d\n", v->pool + v->offsets[id], id);
+    }
+}
+
+// FNV-1a over all words in id order, so two vocabularies hash equal only
+// when they assign the same ids to the same words
+uint64_t vocabulary_hash(const Vocabulary *v)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (int id = 0; id < v->size; id++)
     {
-        VocabularyEntry *entry = v->table[i];
-        while (entry)
+        // Include the terminator so "ab","c" and "a","bc" differ
+        const char *c = v->pool + v->offsets[id];
+        do
         {
-            printf("Word: %s, ID: %d\n", entry->word, entry->id);
-            entry = entry->next;
-        }
+            hash ^= (unsigned char)*c;
+            hash *= 0x100000001b3ull;
+        } while (*c++);
     }
+    return hash;
 }
 
 // Function to create a one-hot encoded vector for a given word
@@ -158,8 +242,8 @@ Matrix *create_one_hot_vector(Vocabulary *v, char *word)
     int index = vocabulary_get_index(v, word);
     if (index == -1)
     {
-        fprintf(stderr, "Word '%s' not found in vocabulary\n", word);
-        exit(1);
+        fprintf(stderr, "Word '%s' not found in vocabulary, using <unk>\n", word);
+        index = VOCAB_UNK;
     }
     Matrix *one_hot = matrix_create(v->size, 1);
     for (int i = 0; i < v->size; i++)
@@ -167,4 +251,124 @@ Matrix *create_one_hot_vector(Vocabulary *v, char *word)
         one_hot->entries[i][0] = (i == index) ? 1.0 : 0.0;
     }
     return one_hot;
-}
\ No newline at end of file
+}
+
+// The file is the in-memory layout: header, offsets, buckets, next, pool
+int vocabulary_save(const Vocabulary *v, const char *filename)
+{
+    FILE *file = fopen(filename, "wb");
+    if (!file)
+    {
+        fprintf(stderr, "Error: Unable to open file for saving vocabulary\n");
+        return -1;
+    }
+
+    VocabularyHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = VOCABULARY_MAGIC;
+    header.version = VOCABULARY_VERSION;
+    header.size = (uint32_t)v->size;
+    header.capacity = (uint32_t)v->capacity;
+    header.pool_size = v->pool_size;
+    header.hash = vocabulary_hash(v);
+
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(v->offsets, sizeof(uint32_t), v->size, file) == (size_t)v->size &&
+             fwrite(v->buckets, sizeof(int32_t), v->capacity, file) == (size_t)v->capacity &&
+             fwrite(v->next, sizeof(int32_t), v->size, file) == (size_t)v->size &&
+             fwrite(v->pool, 1, v->pool_size, file) == v->pool_size;
+
+    if (fclose(file) != 0 || !ok)
+    {
+        fprintf(stderr, "Error: Failed to write vocabulary to %s\n", filename);
+        return -1;
+    }
+    return 0;
+}
+
+Vocabulary *vocabulary_load(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Error: Unable to open file for loading vocabulary\n");
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(VocabularyHeader))
+    {
+        fprintf(stderr, "Error: %s is too small to be a vocabulary file\n", filename);
+        close(fd);
+        return NULL;
+    }
+
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        perror("Failed to map vocabulary file");
+        return NULL;
+    }
+
+    const VocabularyHeader *header = (const VocabularyHeader *)mapping;
+    size_t expected = sizeof(VocabularyHeader) +
+                      (size_t)header->size * sizeof(uint32_t) +
+                      (size_t)header->capacity * sizeof(int32_t) +
+                      (size_t)header->size * sizeof(int32_t) +
+                      header->pool_size;
+    if (header->magic != VOCABULARY_MAGIC || header->version != VOCABULARY_VERSION ||
+        header->capacity == 0 || header->size > header->capacity || header->pool_size > (uint64_t)st.st_size ||
+        expected != (size_t)st.st_size)
+    {
+        fprintf(stderr, "Error: %s is not a valid vocabulary file\n", filename);
+        munmap(mapping, st.st_size);
+        return NULL;
+    }
+
+    Vocabulary *v = (Vocabulary *)calloc(1, sizeof(Vocabulary));
+    if (!v)
+    {
+        munmap(mapping, st.st_size);
+        return NULL;
+    }
+
+    // Point straight into the mapping; nothing is copied until a word is added
+    char *base = (char *)mapping + sizeof(VocabularyHeader);
+    v->offsets = (uint32_t *)base;
+    base += header->size * sizeof(uint32_t);
+    v->buckets = (int32_t *)base;
+    base += header->capacity * sizeof(int32_t);
+    v->next = (int32_t *)base;
+    base += header->size * sizeof(int32_t);
+    v->pool = base;
+    v->pool_size = header->pool_size;
+    v->pool_capacity = header->pool_size;
+    v->size = (int)header->size;
+    v->capacity = (int)header->capacity;
+    v->mapping = mapping;
+    v->mapping_size = st.st_size;
+
+    // The size checks above only cover the layout; check every index before
+    // following one, so a corrupt file is reported instead of read out of bounds.
+    // Chains are built by prepending, so next[id] < id, which also rules out cycles.
+    int consistent = v->size == 0 || (v->pool_size > 0 && v->pool[v->pool_size - 1] == '\0');
+    for (int id = 0; consistent && id < v->size; id++)
+        consistent = v->offsets[id] < v->pool_size && v->next[id] >= -1 && v->next[id] < id;
+    for (int b = 0; consistent && b < v->capacity; b++)
+        consistent = v->buckets[b] >= -1 && v->buckets[b] < v->size;
+    if (!consistent)
+    {
+        fprintf(stderr, "Error: %s is corrupted (index out of range)\n", filename);
+        vocabulary_free(v);
+        return NULL;
+    }
+
+    if (vocabulary_hash(v) != header->hash)
+    {
+        fprintf(stderr, "Error: %s is corrupted (vocabulary hash mismatch)\n", filename);
+        vocabulary_free(v);
+        return NULL;
+    }
+    return v;
+}
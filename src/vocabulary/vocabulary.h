@@ -1,34 +1,59 @@
 #pragma once
+#include <stdint.h>
+#include <stddef.h>
 #include "../matrix/matrix.h"
 
-// Enum for special token IDs
+#define VOCABULARY_MAGIC 0x564E4E52u // "RNNV" in little-endian byte order
+#define VOCABULARY_VERSION 1
+
+// Enum for special token IDs, in the order vocabulary_create adds them
 typedef enum
 {
-    VOCAB_UNK = 0,      // <unk>
-    VOCAB_PAD,          // <pad>
+    VOCAB_PAD = 0,      // <pad>
     VOCAB_BOS,          // <bos>
     VOCAB_EOS,          // <eos>
+    VOCAB_UNK,          // <unk>
     VOCAB_SPECIAL_COUNT // Total number of special tokens
 } SpecialTokens;
 
-typedef struct VocabularyEntry
+// The vocabulary is stored flat so it can be written out and mapped back
+// as is: a pool of NUL terminated words, an id -> offset table and a
+// chained hash index over ids.
+typedef struct
 {
-    char *word;
-    int id;
-    struct VocabularyEntry *next; // For chaining (handling collisions)
-} VocabularyEntry;
+    char *pool;           // Words back to back, each NUL terminated
+    uint32_t *offsets;    // offsets[id] is the start of word id in pool
+    int32_t *buckets;     // First id of each hash chain, -1 if empty
+    int32_t *next;        // Next id in the same hash chain, -1 at the end
+    size_t pool_size;     // Bytes used in pool
+    size_t pool_capacity; // Bytes allocated for pool
+    int size;             // Number of words in the vocabulary
+    int capacity;         // Maximum number of words and number of hash buckets
+    void *mapping;        // Backing file mapping, NULL when heap allocated
+    size_t mapping_size;  // Size of the mapping in bytes
+} Vocabulary;
 
+// On-disk header of a vocabulary file, followed by offsets, buckets, next and pool
 typedef struct
 {
-    VocabularyEntry **table;
-    int size;     // Number of words in the vocabulary
-    int capacity; // Capacity of the hash table
-} Vocabulary;
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t capacity;
+    uint64_t pool_size;
+    uint64_t hash; // vocabulary_hash() at save time
+} VocabularyHeader;
 
 Vocabulary *vocabulary_create(int initial_capacity);
 void vocabulary_free(Vocabulary *v);
 int vocabulary_add_word(Vocabulary *v, const char *word);
+int vocabulary_reserve(Vocabulary *v, int capacity); // Grow capacity and rehash; ids are unchanged
 int vocabulary_get_index(const Vocabulary *v, const char *word);
 char *vocabulary_get_word(Vocabulary *v, int index);
 void vocabulary_print(const Vocabulary *v);
-Matrix *create_one_hot_vector(Vocabulary *v, char *word);
\ No newline at end of file
+uint64_t vocabulary_hash(const Vocabulary *v); // Fingerprint of the id -> word mapping
+Matrix *create_one_hot_vector(Vocabulary *v, char *word);
+
+// Persistence
+int vocabulary_save(const Vocabulary *v, const char *filename);
+Vocabulary *vocabulary_load(const char *filename); // Maps the file, no per-word copies